@@ -0,0 +1,993 @@
+#include "batch.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "columnar.h"
+#include "numfmt.h"
+#include "workpool.h"
+
+// ------------------------------
+// defines
+// ------------------------------
+
+#define BATCH_INITIAL_CAPACITY 1024
+#define BATCH_OUTPUT_BUFFER_SIZE (1 << 16)
+/* mapped output is reserved and formatted in windows of at most this size */
+#define BATCH_OUTPUT_WINDOW_SIZE (64 << 20)
+
+/* parallel mode - input is split at line boundaries into chunks of roughly this size */
+#define BATCH_CHUNK_SIZE (1 << 20)
+/* chunks evaluated ahead of the one being written, bounds memory held by reorder buffer */
+#define BATCH_CHUNKS_IN_FLIGHT_PER_WORKER 4
+#define BATCH_MAX_RESULT_LEN (CALC_MAX_FORMATTED_LEN + sizeof(" overflow div0\n"))
+
+// ------------------------------
+// Static helpers
+// ------------------------------
+
+static double NowMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec * 1e3 + (double) ts.tv_nsec / 1e6;
+}
+
+static const char *SkipBlanks(const char *str) {
+    while (*str == ' ' || *str == '\t') {
+        str++;
+    }
+
+    return str;
+}
+
+/* number parsers skip any whitespace, lines of in-memory input must not run into the next one */
+static bool IsLineEnd(const char c) {
+    return c == '\0' || c == '\n' || c == '\r';
+}
+
+static bool ParseOperation(const char symbol, operation_t *op) {
+    switch (symbol) {
+        case '+':
+            *op = ADDITION;
+            return true;
+        case '-':
+            *op = SUBTRACTION;
+            return true;
+        case '*':
+            *op = MULTIPLICATION;
+            return true;
+        case '/':
+            *op = DIVISION;
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* input of single job, either records or rows of expression variables */
+typedef struct BatchInput {
+    batch_record_t *records;
+    uint64_t *rows;
+    size_t stride;
+    size_t count;
+    size_t capacity;
+} batch_input_t;
+
+static bool ReserveInput(batch_input_t *input) {
+    if (input->count < input->capacity) {
+        return true;
+    }
+
+    const size_t capacity = input->capacity == 0 ? BATCH_INITIAL_CAPACITY : input->capacity * 2;
+
+    if (input->stride == 0) {
+        batch_record_t *grown = realloc(input->records, capacity * sizeof(batch_record_t));
+        if (grown == NULL) {
+            return false;
+        }
+        input->records = grown;
+    } else {
+        uint64_t *grown = realloc(input->rows, capacity * input->stride * sizeof(uint64_t));
+        if (grown == NULL) {
+            return false;
+        }
+        input->rows = grown;
+    }
+
+    input->capacity = capacity;
+    return true;
+}
+
+static bool ParseRow(const calc_mode_t mode, const char *line, uint64_t *row, const size_t num_values,
+                     bool *is_empty) {
+    const char *cur = SkipBlanks(line);
+
+    *is_empty = IsLineEnd(*cur) || *cur == '#';
+    if (*is_empty) {
+        return false;
+    }
+
+    for (size_t i = 0; i < num_values; i++) {
+        cur = SkipBlanks(cur);
+        cur = IsLineEnd(*cur) ? NULL : CalcParseValue(mode, cur, &row[i]);
+        if (cur == NULL) {
+            return false;
+        }
+    }
+
+    cur = SkipBlanks(cur);
+    return IsLineEnd(*cur);
+}
+
+/* Returns NULL when line was appended or skipped, otherwise static error message */
+static const char *AppendLine(const calc_mode_t mode, batch_input_t *input, const char *line) {
+    if (!ReserveInput(input)) {
+        return "Out of memory";
+    }
+
+    bool is_empty;
+    const bool parsed = input->stride == 0
+                            ? BatchParseLine(mode, line, &input->records[input->count], &is_empty)
+                            : ParseRow(mode, line, &input->rows[input->count * input->stride], input->stride,
+                                       &is_empty);
+
+    if (parsed) {
+        input->count++;
+    }
+
+    return parsed || is_empty ? NULL : "Malformed calculation";
+}
+
+/* Parses lines of [begin, end), on failure error_line points to the offending line */
+static const char *ParseLines(const calc_mode_t mode, batch_input_t *input, const char *begin, const char *end,
+                              const char **error_line) {
+    for (const char *line = begin; line < end;) {
+        const char *line_end = memchr(line, '\n', (size_t) (end - line));
+        line_end = line_end == NULL ? end : line_end + 1;
+
+        const char *error = AppendLine(mode, input, line);
+        if (error != NULL) {
+            *error_line = line;
+            return error;
+        }
+
+        line = line_end;
+    }
+
+    return NULL;
+}
+
+static void ReportLineError(const char *buffer, const char *error_line, const char *error) {
+    /* line numbers are only needed on failure, so they are counted only then */
+    size_t line_num = 1;
+    for (const char *cur = buffer; (cur = memchr(cur, '\n', (size_t) (error_line - cur))) != NULL; cur++) {
+        line_num++;
+    }
+
+    const char *line_end = strchr(error_line, '\n');
+    fprintf(stderr, "%s at line %zu: %.*s\n", error, line_num,
+            (int) (line_end == NULL ? strlen(error_line) : (size_t) (line_end - error_line)), error_line);
+}
+
+/* Writes single output line into out of at least BATCH_MAX_RESULT_LEN bytes, returns its length */
+static size_t FormatResult(const batch_options_t *options, const calc_result_t result, char *out) {
+    size_t len;
+
+    /* hex and binary print raw bit pattern of any mode, as the leds show it */
+    if (options->radix == 16) {
+        memcpy(out, "0x", 2);
+        len = 2 + NumFmtU64ToHex(result.value, out + 2);
+    } else if (options->radix == 2) {
+        memcpy(out, "0b", 2);
+        len = 2 + NumFmtU64ToBinary(result.value, out + 2);
+    } else {
+        len = CalcFormatValue(options->mode, result.value, out);
+    }
+
+    if (result.flags & CALC_FLAG_OVERFLOW) {
+        memcpy(out + len, " overflow", sizeof(" overflow") - 1);
+        len += sizeof(" overflow") - 1;
+    }
+
+    if (result.flags & CALC_FLAG_DIV_BY_ZERO) {
+        memcpy(out + len, " div0", sizeof(" div0") - 1);
+        len += sizeof(" div0") - 1;
+    }
+
+    out[len++] = '\n';
+    return len;
+}
+
+static int WriteResults(const batch_options_t *options, FILE *out, const calc_result_t *results, const size_t count) {
+    char line[BATCH_MAX_RESULT_LEN];
+
+    for (size_t i = 0; i < count; i++) {
+        const size_t len = FormatResult(options, results[i], line);
+
+        if (fwrite(line, 1, len, out) != len) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void EvaluateInput(const calc_mode_t mode, const expr_program_t *program, const batch_input_t *input,
+                          calc_result_t *results) {
+    if (program != NULL) {
+        ExprEvaluate(program, input->rows, input->stride, results, input->count);
+    } else {
+        BatchEvaluate(mode, input->records, results, input->count);
+    }
+}
+
+/* whole input as NUL terminated text */
+typedef struct BatchBuffer {
+    char *data;
+    size_t size;
+    /* length of the mapping, 0 when data is heap allocated */
+    size_t mapped_len;
+} batch_buffer_t;
+
+static bool MapInput(const int fd, const size_t size, batch_buffer_t *buffer) {
+    /*
+     * Parsers need NUL after the last byte, which the file mapping can't provide when file size
+     * is multiple of page size. Reserve one zero page more and map the file over the reservation.
+     */
+    const size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    const size_t mapped_len = (size / page + 1) * page;
+
+    char *base = mmap(NULL, mapped_len, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        return false;
+    }
+
+    if (size > 0 && mmap(base, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(base, mapped_len);
+        return false;
+    }
+
+    /* hints only, input is read once front to back, pages fault in as parsing streams through them */
+    madvise(base, mapped_len, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    madvise(base, mapped_len, MADV_HUGEPAGE);
+#endif
+
+    buffer->data = base;
+    buffer->size = size;
+    buffer->mapped_len = mapped_len;
+    return true;
+}
+
+static int LoadInput(const char *path, const bool use_mmap, batch_buffer_t *buffer) {
+    const bool is_stdin = strcmp(path, BATCH_STDIO_PATH) == 0;
+    const int fd = is_stdin ? STDIN_FILENO : open(path, O_RDONLY);
+
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct stat st;
+    const bool regular = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+
+    if (regular && use_mmap && MapInput(fd, (size_t) st.st_size, buffer)) {
+        if (!is_stdin) {
+            close(fd);
+        }
+        return 0;
+    }
+
+    /* regular files are read in one go, pipes grow the buffer as they go */
+    size_t capacity = regular ? (size_t) st.st_size + 1 : BATCH_CHUNK_SIZE;
+    char *data = malloc(capacity);
+    size_t len = 0;
+
+    while (data != NULL) {
+        if (len + 1 == capacity) {
+            char *grown = realloc(data, capacity * 2);
+            if (grown == NULL) {
+                free(data);
+                data = NULL;
+                break;
+            }
+
+            data = grown;
+            capacity *= 2;
+        }
+
+        const ssize_t ret = read(fd, data + len, capacity - len - 1);
+        if (ret <= 0) {
+            if (ret < 0) {
+                free(data);
+                data = NULL;
+            }
+            break;
+        }
+
+        len += (size_t) ret;
+    }
+
+    if (!is_stdin) {
+        close(fd);
+    }
+
+    if (data == NULL) {
+        return -1;
+    }
+
+    data[len] = '\0';
+    buffer->data = data;
+    buffer->size = len;
+    buffer->mapped_len = 0;
+    return 0;
+}
+
+static void ReleaseInput(batch_buffer_t *buffer) {
+    if (buffer->mapped_len > 0) {
+        munmap(buffer->data, buffer->mapped_len);
+    } else {
+        free(buffer->data);
+    }
+
+    buffer->data = NULL;
+}
+
+static char *MapOutputWindow(const int fd, const size_t offset, const size_t size) {
+    /* blocks are allocated upfront, full disk fails here instead of raising SIGBUS on a store */
+    const int error = posix_fallocate(fd, (off_t) offset, (off_t) size);
+    if (error != 0) {
+        errno = error;
+        return MAP_FAILED;
+    }
+
+    char *window = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, (off_t) offset);
+    if (window != MAP_FAILED) {
+        madvise(window, size, MADV_SEQUENTIAL);
+    }
+
+    return window;
+}
+
+/*
+ * Formats results straight into output file, mapped in windows sized for the worst case of results
+ * still to come but never more than BATCH_OUTPUT_WINDOW_SIZE, then trims it to the real length.
+ * Outputs that can't be mapped, e.g. pipes or devices, are written through stdio instead.
+ */
+static int WriteResultsMapped(const batch_options_t *options, const char *path, const calc_result_t *results,
+                              const size_t count) {
+    const int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    if (!S_ISREG(st.st_mode)) {
+        FILE *out = fdopen(fd, "w");
+        if (out == NULL) {
+            close(fd);
+            return -1;
+        }
+
+        setvbuf(out, NULL, _IOFBF, BATCH_OUTPUT_BUFFER_SIZE);
+        int ret = WriteResults(options, out, results, count);
+        ret |= fclose(out) == 0 ? 0 : -1;
+        return ret;
+    }
+
+    const size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    char *window = NULL;
+    size_t window_offset = 0;
+    size_t window_size = 0;
+    size_t len = 0;
+    int ret = ftruncate(fd, 0);
+
+    for (size_t i = 0; ret == 0 && i < count; i++) {
+        if (len + BATCH_MAX_RESULT_LEN > window_offset + window_size) {
+            if (window != NULL) {
+                ret = munmap(window, window_size);
+            }
+
+            /* mapping offset has to be page aligned, so the next window starts with the partial page */
+            window_offset = len / page * page;
+            const size_t needed = len - window_offset + (count - i) * BATCH_MAX_RESULT_LEN;
+            window_size = needed < BATCH_OUTPUT_WINDOW_SIZE ? needed : BATCH_OUTPUT_WINDOW_SIZE;
+
+            window = ret == 0 ? MapOutputWindow(fd, window_offset, window_size) : MAP_FAILED;
+            if (window == MAP_FAILED) {
+                /* partially written output is dropped */
+                const int saved = errno;
+                ftruncate(fd, 0);
+                close(fd);
+                errno = saved;
+                return -1;
+            }
+        }
+
+        len += FormatResult(options, results[i], window + (len - window_offset));
+    }
+
+    if (window != NULL) {
+        ret |= munmap(window, window_size);
+    }
+
+    ret |= ftruncate(fd, (off_t) len);
+    ret |= close(fd);
+
+    return ret < 0 ? -1 : 0;
+}
+
+/* one piece of parallel batch, output is kept until all preceding chunks are written */
+typedef struct BatchChunk {
+    const char *begin;
+    const char *end;
+
+    char *out;
+    size_t out_len;
+    size_t count;
+    /* malformed line and its error, NULL when whole chunk was processed */
+    const char *error_line;
+    const char *error;
+    bool done;
+} batch_chunk_t;
+
+typedef struct BatchJob {
+    const batch_options_t *options;
+    const expr_program_t *program;
+    size_t stride;
+
+    batch_chunk_t *chunks;
+    size_t num_chunks;
+
+    /* guards done flags of chunks */
+    pthread_mutex_t lock;
+    pthread_cond_t done_cond;
+} batch_job_t;
+
+static void ProcessChunk(void *ctx, const size_t item, const size_t worker) {
+    (void) worker;
+
+    batch_job_t *job = ctx;
+    batch_chunk_t *chunk = &job->chunks[item];
+    batch_input_t input = {.stride = job->stride};
+    calc_result_t *results = NULL;
+
+    chunk->error = ParseLines(job->options->mode, &input, chunk->begin, chunk->end, &chunk->error_line);
+
+    if (chunk->error == NULL) {
+        results = malloc((input.count ? input.count : 1) * sizeof(calc_result_t));
+        chunk->out = malloc((input.count ? input.count : 1) * BATCH_MAX_RESULT_LEN);
+
+        if (results == NULL || chunk->out == NULL) {
+            chunk->error = "Out of memory";
+        }
+    }
+
+    if (chunk->error == NULL) {
+        EvaluateInput(job->options->mode, job->program, &input, results);
+
+        for (size_t i = 0; i < input.count; i++) {
+            chunk->out_len += FormatResult(job->options, results[i], chunk->out + chunk->out_len);
+        }
+
+        chunk->count = input.count;
+    }
+
+    free(results);
+    free(input.records);
+    free(input.rows);
+
+    pthread_mutex_lock(&job->lock);
+    chunk->done = true;
+    pthread_cond_broadcast(&job->done_cond);
+    pthread_mutex_unlock(&job->lock);
+}
+
+static size_t SplitChunks(const char *buffer, const size_t size, batch_chunk_t **chunks) {
+    const size_t capacity = size / BATCH_CHUNK_SIZE + 1;
+    *chunks = calloc(capacity, sizeof(batch_chunk_t));
+
+    if (*chunks == NULL) {
+        return 0;
+    }
+
+    size_t num_chunks = 0;
+    const char *cur = buffer;
+    const char *end = buffer + size;
+
+    /* every chunk but the last one is extended up to the end of its last line */
+    while (cur < end) {
+        const char *chunk_end = (size_t) (end - cur) <= BATCH_CHUNK_SIZE ? end : cur + BATCH_CHUNK_SIZE;
+        const char *line_end = chunk_end == end ? NULL : memchr(chunk_end, '\n', (size_t) (end - chunk_end));
+
+        chunk_end = chunk_end == end || line_end == NULL ? end : line_end + 1;
+
+        (*chunks)[num_chunks].begin = cur;
+        (*chunks)[num_chunks].end = chunk_end;
+        num_chunks++;
+        cur = chunk_end;
+    }
+
+    return num_chunks;
+}
+
+static int RunParallel(const batch_options_t *options, const expr_program_t *program, const size_t stride,
+                       const char *input_path, const char *output_path) {
+    const double start = NowMs();
+
+    /*
+     * Whole input is held for chunking, mapped for regular files and read into heap for pipes.
+     * The in-flight window bounds only formatted output waiting for its turn.
+     */
+    batch_buffer_t input;
+    if (LoadInput(input_path, options->use_mmap, &input) < 0) {
+        perror(input_path);
+        return -1;
+    }
+
+    const char *buffer = input.data;
+    const size_t size = input.size;
+
+    batch_job_t job = {
+        .options = options,
+        .program = program,
+        .stride = stride,
+    };
+
+    job.num_chunks = SplitChunks(buffer, size, &job.chunks);
+    if (job.chunks == NULL) {
+        ReleaseInput(&input);
+        return -1;
+    }
+
+    const bool output_stdout = strcmp(output_path, BATCH_STDIO_PATH) == 0;
+    FILE *out = output_stdout ? stdout : fopen(output_path, "w");
+    if (out == NULL) {
+        perror(output_path);
+        free(job.chunks);
+        ReleaseInput(&input);
+        return -1;
+    }
+
+    const size_t num_workers = options->num_threads < WORK_POOL_MAX_WORKERS
+                                   ? options->num_threads
+                                   : WORK_POOL_MAX_WORKERS;
+    const size_t window = num_workers * BATCH_CHUNKS_IN_FLIGHT_PER_WORKER;
+
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.done_cond, NULL);
+
+    work_pool_t pool = {};
+    int ret = WorkPoolStart(&pool, num_workers, window, ProcessChunk, &job);
+    size_t num_submitted = 0;
+    size_t num_records = 0;
+
+    /* reorder buffer - chunks finish in any order, but leave strictly in input order */
+    for (size_t next = 0; ret == 0 && next < job.num_chunks; next++) {
+        while (num_submitted < job.num_chunks && num_submitted < next + window) {
+            /* chunk not fitting its deque runs right here, the loop below would wait for it forever */
+            if (!WorkPoolSubmit(&pool, num_submitted)) {
+                ProcessChunk(&job, num_submitted, 0);
+            }
+            num_submitted++;
+        }
+
+        batch_chunk_t *chunk = &job.chunks[next];
+
+        pthread_mutex_lock(&job.lock);
+        while (!chunk->done) {
+            pthread_cond_wait(&job.done_cond, &job.lock);
+        }
+        pthread_mutex_unlock(&job.lock);
+
+        /* unlike serial run, results of chunks before the malformed line are already written */
+        if (chunk->error != NULL) {
+            ReportLineError(buffer, chunk->error_line, chunk->error);
+            ret = -1;
+            break;
+        }
+
+        if (fwrite(chunk->out, 1, chunk->out_len, out) != chunk->out_len) {
+            perror(output_path);
+            ret = -1;
+        }
+
+        num_records += chunk->count;
+        free(chunk->out);
+        chunk->out = NULL;
+    }
+
+    if (pool.num_workers > 0) {
+        WorkPoolStop(&pool);
+    }
+
+    if (fflush(out) != 0 || (!output_stdout && fclose(out) != 0)) {
+        perror(output_path);
+        ret = -1;
+    }
+
+    if (options->bench) {
+        const double total_ms = NowMs() - start;
+
+        fprintf(stderr, "records: %zu\n"
+                "workers:  %zu, chunks: %zu, stolen: %lu\n"
+                "total:    %10.3f ms (%.2f Mrec/s, %.2f MiB/s)\n",
+                num_records, num_workers, job.num_chunks, atomic_load(&pool.num_stolen),
+                total_ms, total_ms > 0 ? (double) num_records / total_ms / 1e3 : 0.0,
+                total_ms > 0 ? (double) size / (1 << 20) / (total_ms / 1e3) : 0.0);
+    }
+
+    for (size_t i = 0; i < job.num_chunks; i++) {
+        free(job.chunks[i].out);
+    }
+
+    pthread_mutex_destroy(&job.lock);
+    pthread_cond_destroy(&job.done_cond);
+    free(job.chunks);
+    ReleaseInput(&input);
+
+    return ret;
+}
+
+/* Stores evaluated text input as columnar results file */
+static int WriteResultsColumnar(const calc_mode_t mode, const char *path, const calc_result_t *results,
+                                const size_t count) {
+    columnar_file_t file;
+
+    if (ColumnarCreate(&file, path, mode, COLUMNAR_KIND_RESULTS, count) < 0) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        file.values[i] = results[i].value;
+        file.flags[i] = (uint8_t) results[i].flags;
+    }
+
+    return ColumnarClose(&file);
+}
+
+static const char *OutputMethod(const batch_options_t *options, const char *output_path) {
+    if (options->output_format == BATCH_FORMAT_COLUMNAR) {
+        return "columnar";
+    }
+
+    struct stat st;
+    const bool regular = strcmp(output_path, BATCH_STDIO_PATH) != 0 && stat(output_path, &st) == 0 &&
+                         S_ISREG(st.st_mode);
+
+    return options->use_mmap && regular ? "mmap" : "stdio";
+}
+
+static int WriteOutput(const batch_options_t *options, const char *output_path, const calc_result_t *results,
+                       const size_t count) {
+    if (options->output_format == BATCH_FORMAT_COLUMNAR) {
+        return WriteResultsColumnar(options->mode, output_path, results, count);
+    }
+
+    const bool output_stdout = strcmp(output_path, BATCH_STDIO_PATH) == 0;
+    if (options->use_mmap && !output_stdout) {
+        return WriteResultsMapped(options, output_path, results, count);
+    }
+
+    FILE *out = output_stdout ? stdout : fopen(output_path, "w");
+    if (out == NULL) {
+        return -1;
+    }
+
+    setvbuf(out, NULL, _IOFBF, BATCH_OUTPUT_BUFFER_SIZE);
+    int ret = WriteResults(options, out, results, count);
+    ret |= fflush(out) == 0 ? 0 : -1;
+
+    if (!output_stdout) {
+        ret |= fclose(out) == 0 ? 0 : -1;
+    }
+
+    return ret;
+}
+
+/* Evaluates columnar jobs file, columnar output is produced straight inside its mapping */
+static int RunColumnar(const batch_options_t *options, const char *input_path, const char *output_path) {
+    const double load_start = NowMs();
+
+    columnar_file_t jobs;
+    if (ColumnarOpen(&jobs, input_path) < 0) {
+        fprintf(stderr, "%s: malformed columnar file\n", input_path);
+        return -1;
+    }
+
+    if (jobs.header->kind != COLUMNAR_KIND_JOBS || !ColumnarMatchesMode(&jobs, options->mode)) {
+        fprintf(stderr, "%s: columnar file holds no jobs of the configured number mode\n", input_path);
+        ColumnarClose(&jobs);
+        return -1;
+    }
+
+    const size_t count = jobs.header->num_records;
+    const double eval_start = NowMs();
+    double format_start;
+    int ret;
+
+    if (options->output_format == BATCH_FORMAT_COLUMNAR) {
+        columnar_file_t out;
+
+        ret = ColumnarCreate(&out, output_path, options->mode, COLUMNAR_KIND_RESULTS, count);
+        if (ret == 0) {
+            ColumnarEvaluate(&jobs, options->mode, out.values, out.flags);
+            format_start = NowMs();
+            ret = ColumnarClose(&out);
+        } else {
+            format_start = NowMs();
+        }
+    } else {
+        uint64_t *values = malloc((count ? count : 1) * sizeof(uint64_t));
+        uint8_t *flags = malloc(count ? count : 1);
+        calc_result_t *results = malloc((count ? count : 1) * sizeof(calc_result_t));
+
+        ret = values == NULL || flags == NULL || results == NULL ? -1 : 0;
+
+        if (ret == 0) {
+            ColumnarEvaluate(&jobs, options->mode, values, flags);
+        }
+
+        format_start = NowMs();
+
+        if (ret == 0) {
+            for (size_t i = 0; i < count; i++) {
+                results[i] = (calc_result_t) {.value = values[i], .flags = flags[i]};
+            }
+
+            ret = WriteOutput(options, output_path, results, count);
+        }
+
+        free(values);
+        free(flags);
+        free(results);
+    }
+
+    const double end = NowMs();
+
+    if (ret < 0) {
+        perror(output_path);
+    }
+
+    if (options->bench) {
+        const size_t num_blocks = (count + COLUMNAR_BLOCK_SIZE - 1) / COLUMNAR_BLOCK_SIZE;
+        size_t num_homogeneous = 0;
+
+        for (size_t i = 0; i < num_blocks; i++) {
+            num_homogeneous += jobs.block_ops[i] != COLUMNAR_MIXED_BLOCK;
+        }
+
+        const double eval_ms = format_start - eval_start;
+
+        fprintf(stderr, "records: %zu\n"
+                "load:     %10.3f ms (columnar, %.2f MiB)\n"
+                "blocks:   %zu, single operation: %zu\n"
+                "evaluate: %10.3f ms (%.2f Mrec/s, %.2f ns/rec)\n"
+                "format:   %10.3f ms (%s)\n"
+                "total:    %10.3f ms (%.2f Mrec/s)\n",
+                count, eval_start - load_start, (double) jobs.size / (1 << 20),
+                num_blocks, num_homogeneous,
+                eval_ms, eval_ms > 0 ? (double) count / eval_ms / 1e3 : 0.0,
+                count ? eval_ms * 1e6 / (double) count : 0.0,
+                end - format_start, OutputMethod(options, output_path),
+                end - load_start, end > load_start ? (double) count / (end - load_start) / 1e3 : 0.0);
+    }
+
+    ColumnarClose(&jobs);
+    return ret;
+}
+
+// ------------------------------
+// Function implementations
+// ------------------------------
+
+bool BatchParseLine(const calc_mode_t mode, const char *line, batch_record_t *record, bool *is_empty) {
+    const char *cur = SkipBlanks(line);
+
+    *is_empty = IsLineEnd(*cur) || *cur == '#';
+    if (*is_empty) {
+        return false;
+    }
+
+    cur = CalcParseValue(mode, cur, &record->args[0]);
+    if (cur == NULL) {
+        return false;
+    }
+
+    cur = SkipBlanks(cur);
+    if (!ParseOperation(*cur, &record->op)) {
+        return false;
+    }
+
+    cur = SkipBlanks(cur + 1);
+    cur = IsLineEnd(*cur) ? NULL : CalcParseValue(mode, cur, &record->args[1]);
+    if (cur == NULL) {
+        return false;
+    }
+
+    cur = SkipBlanks(cur);
+    return *cur == '\0' || *cur == '\n' || *cur == '\r';
+}
+
+void BatchEvaluate(const calc_mode_t mode, const batch_record_t *records, calc_result_t *results,
+                   const size_t count) {
+    /* mode is loop invariant, so every mode gets its own tight loop */
+    switch (mode.number_mode) {
+        case NUMBER_MODE_SIGNED:
+            for (size_t i = 0; i < count; i++) {
+                results[i] = CalcSigned(records[i].op, (int64_t) records[i].args[0], (int64_t) records[i].args[1]);
+            }
+            break;
+        case NUMBER_MODE_FIXED:
+            for (size_t i = 0; i < count; i++) {
+                results[i] = CalcFixed(records[i].op, (int64_t) records[i].args[0], (int64_t) records[i].args[1],
+                                       mode.frac_bits);
+            }
+            break;
+        case NUMBER_MODE_FLOAT:
+            for (size_t i = 0; i < count; i++) {
+                results[i] = CalcFloat(records[i].op, records[i].args[0], records[i].args[1]);
+            }
+            break;
+        case NUMBER_MODE_MODULAR:
+            /* modulus constants were computed once for the whole batch */
+            for (size_t i = 0; i < count; i++) {
+                results[i] = CalcModular(mode.mod, records[i].op, records[i].args[0], records[i].args[1]);
+            }
+            break;
+        case NUMBER_MODE_UNSIGNED:
+        case LAST_NUMBER_MODE:
+            for (size_t i = 0; i < count; i++) {
+                results[i] = CalcUnsigned(records[i].op, records[i].args[0], records[i].args[1]);
+            }
+            break;
+    }
+}
+
+int BatchRun(const batch_options_t *options, const char *input_path, const char *output_path) {
+    const bool output_stdout = strcmp(output_path, BATCH_STDIO_PATH) == 0;
+    const bool input_columnar = strcmp(input_path, BATCH_STDIO_PATH) != 0 && ColumnarProbe(input_path);
+
+    if (options->output_format == BATCH_FORMAT_COLUMNAR && output_stdout) {
+        fprintf(stderr, "Columnar output needs regular file\n");
+        return -1;
+    }
+
+    if ((input_columnar || options->convert_path != NULL) && options->expr != NULL) {
+        fprintf(stderr, "Columnar jobs hold \"a op b\" calculations, not expression rows\n");
+        return -1;
+    }
+
+    if (input_columnar) {
+        return RunColumnar(options, input_path, output_path);
+    }
+
+    expr_program_t program;
+    batch_input_t input = {};
+
+    if (options->expr != NULL) {
+        const char *error = ExprCompile(&program, options->mode, options->expr_syntax, options->expr);
+        if (error != NULL) {
+            fprintf(stderr, "%s: %s\n", error, options->expr);
+            return -1;
+        }
+
+        /* constant expressions still take one row per line */
+        input.stride = program.num_vars == 0 ? 1 : program.num_vars;
+    }
+
+    /* parallel path streams text, other outputs need the whole result set */
+    if (options->num_threads > 1 && options->output_format == BATCH_FORMAT_TEXT && options->convert_path == NULL) {
+        return RunParallel(options, options->expr != NULL ? &program : NULL, input.stride, input_path, output_path);
+    }
+
+    const double load_start = NowMs();
+
+    batch_buffer_t buffer;
+    if (LoadInput(input_path, options->use_mmap, &buffer) < 0) {
+        perror(input_path);
+        return -1;
+    }
+
+    const double parse_start = NowMs();
+    const char *error_line = NULL;
+    const char *error = ParseLines(options->mode, &input, buffer.data, buffer.data + buffer.size, &error_line);
+
+    if (error != NULL) {
+        ReportLineError(buffer.data, error_line, error);
+    }
+
+    const bool input_mapped = buffer.mapped_len > 0;
+    const size_t input_size = buffer.size;
+    ReleaseInput(&buffer);
+
+    if (error == NULL && options->convert_path != NULL) {
+        const double convert_start = NowMs();
+        const int ret = ColumnarWriteJobs(options->convert_path, options->mode, input.records, input.count);
+
+        if (ret < 0) {
+            perror(options->convert_path);
+        } else if (options->bench) {
+            fprintf(stderr, "records: %zu\n"
+                    "parse:    %10.3f ms\n"
+                    "convert:  %10.3f ms\n",
+                    input.count, convert_start - parse_start, NowMs() - convert_start);
+        }
+
+        free(input.records);
+        return ret;
+    }
+
+    calc_result_t *results = error != NULL ? NULL : malloc((input.count ? input.count : 1) * sizeof(calc_result_t));
+    if (results == NULL) {
+        free(input.records);
+        free(input.rows);
+        return -1;
+    }
+
+    const double eval_start = NowMs();
+    EvaluateInput(options->mode, options->expr != NULL ? &program : NULL, &input, results);
+    const double format_start = NowMs();
+
+    const int ret = WriteOutput(options, output_path, results, input.count);
+    const double end = NowMs();
+
+    if (ret < 0) {
+        perror(output_path);
+    }
+
+    if (options->bench) {
+        const size_t count = input.count;
+        const double eval_ms = format_start - eval_start;
+
+        fprintf(stderr, "records: %zu\n"
+                "load:     %10.3f ms (%s, %.2f MiB)\n"
+                "parse:    %10.3f ms\n"
+                "evaluate: %10.3f ms (%.2f Mrec/s, %.2f ns/rec)\n"
+                "format:   %10.3f ms (%s)\n"
+                "total:    %10.3f ms (%.2f Mrec/s)\n",
+                count, parse_start - load_start, input_mapped ? "mmap" : "read", (double) input_size / (1 << 20),
+                eval_start - parse_start,
+                eval_ms, eval_ms > 0 ? (double) count / eval_ms / 1e3 : 0.0,
+                count ? eval_ms * 1e6 / (double) count : 0.0,
+                end - format_start, OutputMethod(options, output_path),
+                end - load_start, end > load_start ? (double) count / (end - load_start) / 1e3 : 0.0);
+
+        /* baseline - same expression evaluated per record by walking its syntax tree */
+        if (options->expr != NULL) {
+            expr_tree_t *tree = malloc(sizeof(expr_tree_t));
+
+            if (tree != NULL) {
+                ExprBuildTree(tree, &program);
+
+                const double interp_start = NowMs();
+                ExprInterpret(tree, input.rows, input.stride, results, count);
+                const double interp_ms = NowMs() - interp_start;
+
+                fprintf(stderr, "tree:     %10.3f ms (%.2f ns/rec, bytecode %.1fx faster)\n",
+                        interp_ms, count ? interp_ms * 1e6 / (double) count : 0.0,
+                        eval_ms > 0 ? interp_ms / eval_ms : 0.0);
+            }
+
+            free(tree);
+        }
+    }
+
+    free(results);
+    free(input.records);
+    free(input.rows);
+
+    return ret;
+}
@@ -0,0 +1,70 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "calc.h"
+#include "expr.h"
+
+// ------------------------------
+// defines
+// ------------------------------
+
+#define BATCH_STDIO_PATH "-"
+
+/* text input is recognized by content, output format is chosen by caller */
+typedef enum BatchFormat {
+    BATCH_FORMAT_TEXT = 0,
+    /* binary arrays described in columnar.h, output needs regular file */
+    BATCH_FORMAT_COLUMNAR,
+    LAST_BATCH_FORMAT
+} batch_format_t;
+
+/*
+ * Non-interactive calculator. Input holds one calculation per line: "<arg0> <op> <arg1>",
+ * where op is one of + - * / and numbers follow the configured number mode, integer modes also take
+ * 0x / 0b prefixed bit patterns. When expression is given, lines hold whitespace separated values
+ * of its variables a, b, c, ... instead.
+ * Empty lines and lines starting with # are skipped. Every calculation produces one output line
+ * with the result, followed by " overflow" and/or " div0" when the corresponding flag was raised.
+ * Input file starting with columnar magic holds binary "a op b" jobs instead of text.
+ */
+typedef struct BatchRecord {
+    uint64_t args[2];
+    operation_t op;
+} batch_record_t;
+
+typedef struct BatchOptions {
+    calc_mode_t mode;
+    /* print per stage timings and throughput to stderr */
+    bool bench;
+    /* expression evaluated over every line, NULL for "a op b" lines */
+    const char *expr;
+    expr_syntax_t expr_syntax;
+    /* more than one splits input into chunks evaluated by worker pool */
+    size_t num_threads;
+    /* regular files are mapped and parsed in place, output files are written through bounded mapped windows */
+    bool use_mmap;
+    batch_format_t output_format;
+    /* 10 prints values of the number mode, 16 and 2 print raw bit patterns with 0x / 0b prefix */
+    unsigned radix;
+    /* text input is only converted into columnar jobs file at this path, nothing is evaluated */
+    const char *convert_path;
+} batch_options_t;
+
+// ------------------------------
+// Function definitions
+// ------------------------------
+
+/* Runs whole batch job, returns negative value on failure. Paths equal to "-" mean stdin/stdout */
+int BatchRun(const batch_options_t *options, const char *input_path, const char *output_path);
+
+/* Parses single text line, returns false when line holds no calculation */
+bool BatchParseLine(calc_mode_t mode, const char *line, batch_record_t *record, bool *is_empty);
+
+/* Evaluates records[0, count) into results */
+void BatchEvaluate(calc_mode_t mode, const batch_record_t *records, calc_result_t *results, size_t count);
+
+#endif // BATCH_H
@@ -0,0 +1,281 @@
+#include "calc.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "numfmt.h"
+
+// ------------------------------
+// defines
+// ------------------------------
+
+/* largest power of ten exactly representable in binary64 */
+#define MAX_EXACT_POW10 22
+/* fraction digits that still fit into 64-bit accumulator */
+#define MAX_PARSED_FRAC_DIGITS 18
+/* past these exponents any int64_t mantissa has overflowed or dropped to zero, clamping bounds the loops */
+#define MAX_WIDE_POW10 39
+#define MAX_FLOAT_POW10 360
+
+static const double kExactPowersOf10[MAX_EXACT_POW10 + 1] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+// ------------------------------
+// Static helpers
+// ------------------------------
+
+static int64_t ClampExponent(const int64_t exponent, const int64_t limit) {
+    return exponent > limit ? limit : exponent < -limit ? -limit : exponent;
+}
+
+static double ScaleByPow10(double value, int64_t exponent) {
+    exponent = ClampExponent(exponent, MAX_FLOAT_POW10);
+
+    /* exact powers keep single rounding for common exponents */
+    while (exponent > MAX_EXACT_POW10) {
+        value *= kExactPowersOf10[MAX_EXACT_POW10];
+        exponent -= MAX_EXACT_POW10;
+    }
+
+    while (exponent < -MAX_EXACT_POW10) {
+        value /= kExactPowersOf10[MAX_EXACT_POW10];
+        exponent += MAX_EXACT_POW10;
+    }
+
+    return exponent >= 0 ? value * kExactPowersOf10[exponent] : value / kExactPowersOf10[-exponent];
+}
+
+static uint32_t FixedFromParts(const unsigned frac_bits, const int64_t mantissa, int64_t exponent,
+                               uint64_t *value) {
+    __int128 wide = (__int128) mantissa * ((__int128) 1 << frac_bits);
+    uint32_t flags = 0;
+
+    exponent = ClampExponent(exponent, MAX_WIDE_POW10);
+    for (; exponent > 0; exponent--) {
+        wide *= 10;
+
+        if (wide != (__int128) (int64_t) wide) {
+            flags = CALC_FLAG_OVERFLOW;
+            break;
+        }
+    }
+
+    for (; exponent < 0 && wide != 0; exponent++) {
+        wide /= 10;
+    }
+
+    *value = (uint64_t) (int64_t) wide;
+    return flags | (uint32_t) (wide != (__int128) (int64_t) wide) * CALC_FLAG_OVERFLOW;
+}
+
+static size_t FormatFixed(const unsigned frac_bits, const uint64_t value, char *out) {
+    const bool negative = (int64_t) value < 0;
+    const uint64_t magnitude = negative ? (uint64_t) 0 - value : value;
+    const uint64_t frac_mask = ((uint64_t) 1 << frac_bits) - 1;
+
+    size_t len = 0;
+    if (negative) {
+        out[len++] = '-';
+    }
+
+    len += NumFmtU64ToDecimal(magnitude >> frac_bits, out + len);
+
+    /* binary fraction has finite decimal expansion, at most frac_bits digits */
+    uint64_t frac = magnitude & frac_mask;
+    if (frac != 0) {
+        out[len++] = '.';
+    }
+
+    while (frac != 0) {
+        const unsigned __int128 scaled = (unsigned __int128) frac * 10;
+        out[len++] = (char) ('0' + (unsigned) (scaled >> frac_bits));
+        frac = (uint64_t) scaled & frac_mask;
+    }
+
+    out[len] = '\0';
+    return len;
+}
+
+static const char *ParseFixed(const unsigned frac_bits, const char *str, uint64_t *value) {
+    const char *cur = str;
+    while (*cur == ' ' || *cur == '\t') {
+        cur++;
+    }
+
+    const bool negative = *cur == '-';
+    if (*cur == '-' || *cur == '+') {
+        cur++;
+    }
+
+    if ((*cur < '0' || *cur > '9') && *cur != '.') {
+        return NULL;
+    }
+
+    unsigned __int128 int_part = 0;
+    if (*cur != '.') {
+        cur = NumFmtParseU128(cur, 10, &int_part);
+        if (cur == NULL) {
+            return NULL;
+        }
+    }
+
+    /* fraction is accumulated as decimal integer and converted with single division */
+    uint64_t frac_digits = 0;
+    uint64_t frac_scale = 1;
+    if (*cur == '.') {
+        cur++;
+
+        for (; *cur >= '0' && *cur <= '9'; cur++) {
+            if (frac_scale < 1000000000000000000ULL) {
+                frac_digits = frac_digits * 10 + (uint64_t) (*cur - '0');
+                frac_scale *= 10;
+            }
+        }
+    }
+
+    /* integer part has 63 - frac_bits bits, larger ones would be cut off by the shift */
+    if (int_part > ((unsigned __int128) 1 << (63 - frac_bits))) {
+        return NULL;
+    }
+
+    const unsigned __int128 frac = ((unsigned __int128) frac_digits << frac_bits) / frac_scale;
+    const unsigned __int128 magnitude = (int_part << frac_bits) | frac;
+
+    /* only negative values reach 2^63 */
+    if (magnitude > (unsigned __int128) INT64_MAX + negative) {
+        return NULL;
+    }
+
+    *value = negative ? (uint64_t) 0 - (uint64_t) magnitude : (uint64_t) magnitude;
+    return cur;
+}
+
+/* Decimal with optional sign, or raw bit pattern after 0x / 0b prefix */
+static const char *ParseInteger(const calc_mode_t mode, const char *str, uint64_t *value) {
+    const char *cur = str;
+    while (*cur == ' ' || *cur == '\t') {
+        cur++;
+    }
+
+    const bool negative = *cur == '-';
+    if (*cur == '-' || *cur == '+') {
+        cur++;
+    }
+
+    unsigned radix = 10;
+    if (cur[0] == '0' && (cur[1] == 'x' || cur[1] == 'X')) {
+        radix = 16;
+        cur += 2;
+    } else if (cur[0] == '0' && (cur[1] == 'b' || cur[1] == 'B')) {
+        radix = 2;
+        cur += 2;
+    }
+
+    uint64_t magnitude;
+    cur = NumFmtParseU64(cur, radix, &magnitude);
+    if (cur == NULL) {
+        return NULL;
+    }
+
+    /* signed decimals keep int64_t range, unsigned ones wrap on minus as strtoull does */
+    if (mode.number_mode == NUMBER_MODE_SIGNED && radix == 10 && magnitude > (uint64_t) INT64_MAX + negative) {
+        return NULL;
+    }
+
+    /* residue of -x, wrapping first would reduce 2^64 - x instead */
+    if (mode.number_mode == NUMBER_MODE_MODULAR && negative) {
+        *value = ModSub(mode.mod, 0, magnitude);
+        return cur;
+    }
+
+    *value = negative ? (uint64_t) 0 - magnitude : magnitude;
+    return cur;
+}
+
+// ------------------------------
+// Function implementations
+// ------------------------------
+
+uint32_t CalcFromParts(const calc_mode_t mode, const int64_t mantissa, int64_t exponent, uint64_t *value) {
+    switch (mode.number_mode) {
+        case NUMBER_MODE_FIXED:
+            return FixedFromParts(mode.frac_bits, mantissa, exponent, value);
+        case NUMBER_MODE_FLOAT: {
+            const double result = ScaleByPow10((double) mantissa, exponent);
+            memcpy(value, &result, sizeof(result));
+            return isinf(result) ? CALC_FLAG_OVERFLOW : 0;
+        }
+        case NUMBER_MODE_UNSIGNED:
+        case NUMBER_MODE_SIGNED:
+        case NUMBER_MODE_MODULAR:
+        case LAST_NUMBER_MODE:
+            break;
+    }
+
+    /* integers take mantissa as is, negative exponents truncate */
+    __int128 wide = mantissa;
+    uint32_t flags = 0;
+
+    exponent = ClampExponent(exponent, MAX_WIDE_POW10);
+
+    for (int64_t i = 0; i < exponent && !flags; i++) {
+        wide *= 10;
+        flags = (uint32_t) (wide != (__int128) (int64_t) wide) * CALC_FLAG_OVERFLOW;
+    }
+
+    for (int64_t i = 0; i > exponent && wide != 0; i--) {
+        wide /= 10;
+    }
+
+    *value = (uint64_t) (int64_t) wide;
+    return flags;
+}
+
+size_t CalcFormatValue(const calc_mode_t mode, const uint64_t value, char *out) {
+    switch (mode.number_mode) {
+        case NUMBER_MODE_SIGNED:
+            if ((int64_t) value < 0) {
+                out[0] = '-';
+                return 1 + NumFmtU64ToDecimal((uint64_t) 0 - value, out + 1);
+            }
+            return NumFmtU64ToDecimal(value, out);
+        case NUMBER_MODE_FIXED:
+            return FormatFixed(mode.frac_bits, value, out);
+        case NUMBER_MODE_FLOAT: {
+            double d;
+            memcpy(&d, &value, sizeof(d));
+            return (size_t) snprintf(out, CALC_MAX_FORMATTED_LEN, "%.17g", d);
+        }
+        case NUMBER_MODE_UNSIGNED:
+        case NUMBER_MODE_MODULAR:
+        case LAST_NUMBER_MODE:
+            break;
+    }
+
+    return NumFmtU64ToDecimal(value, out);
+}
+
+const char *CalcParseValue(const calc_mode_t mode, const char *str, uint64_t *value) {
+    switch (mode.number_mode) {
+        case NUMBER_MODE_FIXED:
+            return ParseFixed(mode.frac_bits, str, value);
+        case NUMBER_MODE_FLOAT: {
+            char *end = NULL;
+            errno = 0;
+
+            const double d = strtod(str, &end);
+            memcpy(value, &d, sizeof(d));
+            return end == str || errno == ERANGE ? NULL : end;
+        }
+        case NUMBER_MODE_UNSIGNED:
+        case NUMBER_MODE_SIGNED:
+        case NUMBER_MODE_MODULAR:
+        case LAST_NUMBER_MODE:
+            break;
+    }
+
+    return ParseInteger(mode, str, value);
+}
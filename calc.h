@@ -0,0 +1,268 @@
+#ifndef CALC_H
+#define CALC_H
+
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "modarith.h"
+
+// ------------------------------
+// defines
+// ------------------------------
+
+#define CALC_FLAG_OVERFLOW (1U << 0)
+#define CALC_FLAG_DIV_BY_ZERO (1U << 1)
+
+/* Q32.32 unless configured otherwise */
+#define CALC_DEFAULT_FRAC_BITS 32
+#define CALC_MAX_FRAC_BITS 62
+
+/* longest text produced by CalcFormatValue, including NUL */
+#define CALC_MAX_FORMATTED_LEN 96
+
+typedef enum Operation {
+    ADDITION = 0,
+    SUBTRACTION,
+    MULTIPLICATION,
+    DIVISION,
+    LAST_OPERATION
+} operation_t;
+
+typedef enum NumberMode {
+    NUMBER_MODE_UNSIGNED = 0,
+    NUMBER_MODE_SIGNED,
+    NUMBER_MODE_FIXED, /* signed Q(63 - frac_bits).(frac_bits) */
+    NUMBER_MODE_FLOAT, /* IEEE-754 binary64 */
+    NUMBER_MODE_MODULAR, /* unsigned modulo fixed modulus, division slot holds exponentiation */
+    LAST_NUMBER_MODE
+} number_mode_t;
+
+typedef struct CalcMode {
+    number_mode_t number_mode;
+    unsigned frac_bits;
+    /* modular mode - precomputed modulus constants, shared by all evaluations */
+    const mod_context_t *mod;
+} calc_mode_t;
+
+/*
+ * Arithmetic primitives shared by interactive calculator and every other evaluation path.
+ * Value always holds raw 64-bit pattern: two's complement for signed and fixed-point numbers,
+ * IEEE-754 bit pattern for floating-point ones.
+ * Division by zero yields 0 with CALC_FLAG_DIV_BY_ZERO set, wrapped results have CALC_FLAG_OVERFLOW set.
+ */
+typedef struct CalcResult {
+    uint64_t value;
+    uint32_t flags;
+} calc_result_t;
+
+// ------------------------------
+// Inline implementations
+// ------------------------------
+
+static inline calc_result_t CalcUnsigned(const operation_t op, const uint64_t a, const uint64_t b) {
+    calc_result_t result = {.value = 0, .flags = 0};
+
+    switch (op) {
+        case ADDITION:
+            result.flags = __builtin_add_overflow(a, b, &result.value) ? CALC_FLAG_OVERFLOW : 0;
+            break;
+        case SUBTRACTION:
+            result.flags = __builtin_sub_overflow(a, b, &result.value) ? CALC_FLAG_OVERFLOW : 0;
+            break;
+        case MULTIPLICATION:
+            result.flags = __builtin_mul_overflow(a, b, &result.value) ? CALC_FLAG_OVERFLOW : 0;
+            break;
+        case DIVISION:
+            if (b == 0) {
+                result.flags = CALC_FLAG_DIV_BY_ZERO;
+                break;
+            }
+            result.value = a / b;
+            break;
+        case LAST_OPERATION:
+            break;
+    }
+
+    return result;
+}
+
+static inline calc_result_t CalcSigned(const operation_t op, const int64_t a, const int64_t b) {
+    calc_result_t result = {.value = 0, .flags = 0};
+    int64_t value = 0;
+
+    switch (op) {
+        case ADDITION:
+            result.flags = __builtin_add_overflow(a, b, &value) ? CALC_FLAG_OVERFLOW : 0;
+            break;
+        case SUBTRACTION:
+            result.flags = __builtin_sub_overflow(a, b, &value) ? CALC_FLAG_OVERFLOW : 0;
+            break;
+        case MULTIPLICATION:
+            result.flags = __builtin_mul_overflow(a, b, &value) ? CALC_FLAG_OVERFLOW : 0;
+            break;
+        case DIVISION:
+            if (b == 0) {
+                result.flags = CALC_FLAG_DIV_BY_ZERO;
+                break;
+            }
+
+            /* INT64_MIN / -1 is the only quotient that does not fit, C division truncates towards zero */
+            if (a == INT64_MIN && b == -1) {
+                value = INT64_MIN;
+                result.flags = CALC_FLAG_OVERFLOW;
+                break;
+            }
+
+            value = a / b;
+            break;
+        case LAST_OPERATION:
+            break;
+    }
+
+    result.value = (uint64_t) value;
+    return result;
+}
+
+static inline calc_result_t CalcFixed(const operation_t op, const int64_t a, const int64_t b, const unsigned frac_bits) {
+    calc_result_t result = {.value = 0, .flags = 0};
+    __int128 wide = 0;
+
+    switch (op) {
+        case ADDITION:
+            wide = (__int128) a + b;
+            break;
+        case SUBTRACTION:
+            wide = (__int128) a - b;
+            break;
+        case MULTIPLICATION:
+            /* full 128-bit product, rounded towards negative infinity */
+            wide = ((__int128) a * b) >> frac_bits;
+            break;
+        case DIVISION:
+            if (b == 0) {
+                result.flags = CALC_FLAG_DIV_BY_ZERO;
+                return result;
+            }
+            /* multiplied, left shift of negative value is undefined */
+            wide = ((__int128) a * ((__int128) 1 << frac_bits)) / b;
+            break;
+        case LAST_OPERATION:
+            break;
+    }
+
+    /* no branch on the result, the flag is just a comparison */
+    result.value = (uint64_t) (int64_t) wide;
+    result.flags = (uint32_t) (wide != (__int128) (int64_t) wide) * CALC_FLAG_OVERFLOW;
+
+    return result;
+}
+
+static inline calc_result_t CalcFloat(const operation_t op, const uint64_t a_bits, const uint64_t b_bits) {
+    double a, b;
+    double value = 0.0;
+
+    memcpy(&a, &a_bits, sizeof(a));
+    memcpy(&b, &b_bits, sizeof(b));
+
+    switch (op) {
+        case ADDITION:
+            value = a + b;
+            break;
+        case SUBTRACTION:
+            value = a - b;
+            break;
+        case MULTIPLICATION:
+            value = a * b;
+            break;
+        case DIVISION:
+            value = a / b;
+            break;
+        case LAST_OPERATION:
+            break;
+    }
+
+    calc_result_t result;
+    memcpy(&result.value, &value, sizeof(value));
+
+    /* IEEE semantics are kept, flags only report what happened - finite operands producing infinity */
+    const bool finite_args = isfinite(a) & isfinite(b);
+    const bool div_by_zero = (op == DIVISION) & (b == 0.0);
+    const bool overflow = finite_args & isinf(value) & !div_by_zero;
+
+    result.flags = (uint32_t) overflow * CALC_FLAG_OVERFLOW | (uint32_t) div_by_zero * CALC_FLAG_DIV_BY_ZERO;
+
+    return result;
+}
+
+/* fixed point and float values are composed from mantissa and decimal exponent */
+static inline bool CalcIsRealMode(const calc_mode_t mode) {
+    return mode.number_mode == NUMBER_MODE_FIXED || mode.number_mode == NUMBER_MODE_FLOAT;
+}
+
+static inline calc_result_t CalcModular(const mod_context_t *ctx, const operation_t op, const uint64_t a,
+                                        const uint64_t b) {
+    calc_result_t result = {.value = 0, .flags = 0};
+
+    switch (op) {
+        case ADDITION:
+            result.value = ModAdd(ctx, a, b);
+            break;
+        case SUBTRACTION:
+            result.value = ModSub(ctx, a, b);
+            break;
+        case MULTIPLICATION:
+            result.value = ModMul(ctx, a, b);
+            break;
+        case DIVISION:
+            result.value = ModExp(ctx, a, b);
+            break;
+        case LAST_OPERATION:
+            break;
+    }
+
+    return result;
+}
+
+static inline calc_result_t CalcEvaluate(const calc_mode_t mode, const operation_t op, const uint64_t a,
+                                         const uint64_t b) {
+    switch (mode.number_mode) {
+        case NUMBER_MODE_SIGNED:
+            return CalcSigned(op, (int64_t) a, (int64_t) b);
+        case NUMBER_MODE_FIXED:
+            return CalcFixed(op, (int64_t) a, (int64_t) b, mode.frac_bits);
+        case NUMBER_MODE_FLOAT:
+            return CalcFloat(op, a, b);
+        case NUMBER_MODE_MODULAR:
+            return CalcModular(mode.mod, op, a, b);
+        case NUMBER_MODE_UNSIGNED:
+        case LAST_NUMBER_MODE:
+            break;
+    }
+
+    return CalcUnsigned(op, a, b);
+}
+
+static inline bool CalcIsSignedMode(const calc_mode_t mode) {
+    return mode.number_mode == NUMBER_MODE_SIGNED || CalcIsRealMode(mode);
+}
+
+// ------------------------------
+// Function definitions
+// ------------------------------
+
+/* Builds value of given mode from mantissa * 10^exponent, returns CALC_FLAG_* describing precision problems */
+uint32_t CalcFromParts(calc_mode_t mode, int64_t mantissa, int64_t exponent, uint64_t *value);
+
+/* Writes textual representation of the value, returns its length */
+size_t CalcFormatValue(calc_mode_t mode, uint64_t value, char *out);
+
+/*
+ * Parses single number at str, returns pointer right after it or NULL when nothing could be parsed
+ * or the number is out of range. Integer modes also take raw bit patterns prefixed with 0x or 0b.
+ */
+const char *CalcParseValue(calc_mode_t mode, const char *str, uint64_t *value);
+
+#endif // CALC_H
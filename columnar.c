@@ -0,0 +1,336 @@
+#include "columnar.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// ------------------------------
+// Static helpers
+// ------------------------------
+
+static size_t AlignUp(const size_t offset) {
+    return (offset + COLUMNAR_ALIGNMENT - 1) & ~(size_t) (COLUMNAR_ALIGNMENT - 1);
+}
+
+static size_t NumBlocks(const size_t num_records) {
+    return (num_records + COLUMNAR_BLOCK_SIZE - 1) / COLUMNAR_BLOCK_SIZE;
+}
+
+/* Sets array pointers of mapped file, returns total size the layout needs */
+static size_t Layout(columnar_file_t *file, char *base, const columnar_kind_t kind, const size_t num_records) {
+    size_t offset = sizeof(columnar_header_t);
+
+    file->arg0 = NULL;
+    file->arg1 = NULL;
+    file->ops = NULL;
+    file->block_ops = NULL;
+    file->values = NULL;
+    file->flags = NULL;
+
+    if (kind == COLUMNAR_KIND_JOBS) {
+        file->arg0 = (uint64_t *) (base + offset);
+        offset = AlignUp(offset + num_records * sizeof(uint64_t));
+        file->arg1 = (uint64_t *) (base + offset);
+        offset = AlignUp(offset + num_records * sizeof(uint64_t));
+        file->ops = (uint8_t *) (base + offset);
+        offset = AlignUp(offset + num_records);
+        file->block_ops = (uint8_t *) (base + offset);
+        return offset + NumBlocks(num_records);
+    }
+
+    file->values = (uint64_t *) (base + offset);
+    offset = AlignUp(offset + num_records * sizeof(uint64_t));
+    file->flags = (uint8_t *) (base + offset);
+    return offset + num_records;
+}
+
+/* Marks blocks whose records all share one operation */
+static void FillBlockOps(const columnar_file_t *file, const size_t num_records) {
+    for (size_t block = 0; block < NumBlocks(num_records); block++) {
+        const size_t begin = block * COLUMNAR_BLOCK_SIZE;
+        const size_t end = begin + COLUMNAR_BLOCK_SIZE < num_records ? begin + COLUMNAR_BLOCK_SIZE : num_records;
+        uint8_t op = file->ops[begin];
+
+        for (size_t i = begin + 1; i < end && op != COLUMNAR_MIXED_BLOCK; i++) {
+            op = file->ops[i] == op ? op : COLUMNAR_MIXED_BLOCK;
+        }
+
+        file->block_ops[block] = op;
+    }
+}
+
+/* Ops are used as operation_t and block ops pick op-specialized loops, so neither is trusted */
+static bool ValidJobs(const columnar_file_t *file, const size_t num_records) {
+    for (size_t block = 0; block < NumBlocks(num_records); block++) {
+        const size_t begin = block * COLUMNAR_BLOCK_SIZE;
+        const size_t end = begin + COLUMNAR_BLOCK_SIZE < num_records ? begin + COLUMNAR_BLOCK_SIZE : num_records;
+        const uint8_t block_op = file->block_ops[block];
+
+        if (block_op >= LAST_OPERATION && block_op != COLUMNAR_MIXED_BLOCK) {
+            return false;
+        }
+
+        for (size_t i = begin; i < end; i++) {
+            if (file->ops[i] >= LAST_OPERATION || (block_op != COLUMNAR_MIXED_BLOCK && file->ops[i] != block_op)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/* mode and op are constants after inlining, so every combination becomes its own branch free loop */
+static inline __attribute__((always_inline)) void EvaluateRun(const calc_mode_t mode, const operation_t op,
+                                                              const uint64_t *arg0, const uint64_t *arg1,
+                                                              uint64_t *values, uint8_t *flags,
+                                                              const size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        const calc_result_t result = CalcEvaluate(mode, op, arg0[i], arg1[i]);
+        values[i] = result.value;
+        flags[i] = (uint8_t) result.flags;
+    }
+}
+
+static inline __attribute__((always_inline)) void EvaluateModeRun(const calc_mode_t mode, const operation_t op,
+                                                                  const uint64_t *arg0, const uint64_t *arg1,
+                                                                  uint64_t *values, uint8_t *flags,
+                                                                  const size_t count) {
+    switch (op) {
+        case SUBTRACTION:
+            EvaluateRun(mode, SUBTRACTION, arg0, arg1, values, flags, count);
+            break;
+        case MULTIPLICATION:
+            EvaluateRun(mode, MULTIPLICATION, arg0, arg1, values, flags, count);
+            break;
+        case DIVISION:
+            EvaluateRun(mode, DIVISION, arg0, arg1, values, flags, count);
+            break;
+        case ADDITION:
+        case LAST_OPERATION:
+            EvaluateRun(mode, ADDITION, arg0, arg1, values, flags, count);
+            break;
+    }
+}
+
+static void EvaluateHomogeneous(const calc_mode_t mode, const operation_t op, const uint64_t *arg0,
+                                const uint64_t *arg1, uint64_t *values, uint8_t *flags, const size_t count) {
+    calc_mode_t fixed_mode = mode;
+
+    switch (mode.number_mode) {
+        case NUMBER_MODE_SIGNED:
+            fixed_mode.number_mode = NUMBER_MODE_SIGNED;
+            EvaluateModeRun(fixed_mode, op, arg0, arg1, values, flags, count);
+            break;
+        case NUMBER_MODE_FIXED:
+            fixed_mode.number_mode = NUMBER_MODE_FIXED;
+            EvaluateModeRun(fixed_mode, op, arg0, arg1, values, flags, count);
+            break;
+        case NUMBER_MODE_FLOAT:
+            fixed_mode.number_mode = NUMBER_MODE_FLOAT;
+            EvaluateModeRun(fixed_mode, op, arg0, arg1, values, flags, count);
+            break;
+        case NUMBER_MODE_MODULAR:
+            fixed_mode.number_mode = NUMBER_MODE_MODULAR;
+            EvaluateModeRun(fixed_mode, op, arg0, arg1, values, flags, count);
+            break;
+        case NUMBER_MODE_UNSIGNED:
+        case LAST_NUMBER_MODE:
+            fixed_mode.number_mode = NUMBER_MODE_UNSIGNED;
+            EvaluateModeRun(fixed_mode, op, arg0, arg1, values, flags, count);
+            break;
+    }
+}
+
+static void EvaluateMixed(const calc_mode_t mode, const uint8_t *ops, const uint64_t *arg0, const uint64_t *arg1,
+                          uint64_t *values, uint8_t *flags, const size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        const calc_result_t result = CalcEvaluate(mode, (operation_t) ops[i], arg0[i], arg1[i]);
+        values[i] = result.value;
+        flags[i] = (uint8_t) result.flags;
+    }
+}
+
+// ------------------------------
+// Function implementations
+// ------------------------------
+
+bool ColumnarProbe(const char *path) {
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    /* only regular files can be mapped, sniffing a pipe would also eat bytes of its text input */
+    struct stat st;
+    char magic[sizeof(((columnar_header_t *) NULL)->magic)];
+    const bool matches = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+                         read(fd, magic, sizeof(magic)) == (ssize_t) sizeof(magic) &&
+                         memcmp(magic, COLUMNAR_MAGIC, sizeof(magic)) == 0;
+
+    close(fd);
+    return matches;
+}
+
+int ColumnarOpen(columnar_file_t *file, const char *path) {
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(columnar_header_t)) {
+        close(fd);
+        return -1;
+    }
+
+    const size_t size = (size_t) st.st_size;
+    char *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+
+    /* arrays are streamed front to back, readahead brings pages in as they are reached */
+    madvise(base, size, MADV_SEQUENTIAL);
+
+    columnar_header_t *header = (columnar_header_t *) base;
+    const bool valid = memcmp(header->magic, COLUMNAR_MAGIC, sizeof(header->magic)) == 0 &&
+                       header->version == COLUMNAR_VERSION && header->kind < LAST_COLUMNAR_KIND &&
+                       header->number_mode < LAST_NUMBER_MODE && header->block_size == COLUMNAR_BLOCK_SIZE &&
+                       /* bounds num_records before layout arithmetic can overflow */
+                       header->num_records <= size / sizeof(uint64_t);
+
+    if (!valid || Layout(file, base, header->kind, header->num_records) > size) {
+        munmap(base, size);
+        close(fd);
+        return -1;
+    }
+
+    if (header->kind == COLUMNAR_KIND_JOBS && !ValidJobs(file, header->num_records)) {
+        munmap(base, size);
+        close(fd);
+        return -1;
+    }
+
+    file->fd = fd;
+    file->base = base;
+    file->size = size;
+    file->header = header;
+    return 0;
+}
+
+int ColumnarCreate(columnar_file_t *file, const char *path, const calc_mode_t mode, const columnar_kind_t kind,
+                   const size_t num_records) {
+    const size_t size = Layout(file, NULL, kind, num_records);
+
+    const int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+
+    /*
+     * The file is sized once, data goes straight into page cache through the mapping.
+     * Blocks are allocated upfront, full disk fails here instead of raising SIGBUS on a store.
+     */
+    char *base = MAP_FAILED;
+    const int error = posix_fallocate(fd, 0, (off_t) size);
+    if (error == 0) {
+        base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    } else {
+        errno = error;
+    }
+
+    if (base == MAP_FAILED) {
+        /* partially allocated file is dropped */
+        const int saved = errno;
+        ftruncate(fd, 0);
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+
+    madvise(base, size, MADV_SEQUENTIAL);
+    Layout(file, base, kind, num_records);
+
+    columnar_header_t *header = (columnar_header_t *) base;
+    memcpy(header->magic, COLUMNAR_MAGIC, sizeof(header->magic));
+    header->version = COLUMNAR_VERSION;
+    header->kind = kind;
+    header->number_mode = mode.number_mode;
+    header->frac_bits = mode.number_mode == NUMBER_MODE_FIXED ? mode.frac_bits : 0;
+    header->modulus = mode.number_mode == NUMBER_MODE_MODULAR ? mode.mod->modulus : 0;
+    header->num_records = num_records;
+    header->block_size = COLUMNAR_BLOCK_SIZE;
+
+    file->fd = fd;
+    file->base = base;
+    file->size = size;
+    file->header = header;
+    return 0;
+}
+
+int ColumnarClose(columnar_file_t *file) {
+    int ret = munmap(file->base, file->size);
+    ret |= close(file->fd);
+
+    file->base = NULL;
+    file->header = NULL;
+    return ret < 0 ? -1 : 0;
+}
+
+bool ColumnarMatchesMode(const columnar_file_t *file, const calc_mode_t mode) {
+    const columnar_header_t *header = file->header;
+
+    if (header->number_mode != (uint32_t) mode.number_mode) {
+        return false;
+    }
+
+    if (mode.number_mode == NUMBER_MODE_FIXED) {
+        return header->frac_bits == mode.frac_bits;
+    }
+
+    if (mode.number_mode == NUMBER_MODE_MODULAR) {
+        return header->modulus == mode.mod->modulus;
+    }
+
+    return true;
+}
+
+int ColumnarWriteJobs(const char *path, const calc_mode_t mode, const batch_record_t *records, const size_t count) {
+    columnar_file_t file;
+
+    if (ColumnarCreate(&file, path, mode, COLUMNAR_KIND_JOBS, count) < 0) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        file.arg0[i] = records[i].args[0];
+        file.arg1[i] = records[i].args[1];
+        file.ops[i] = (uint8_t) records[i].op;
+    }
+
+    FillBlockOps(&file, count);
+    return ColumnarClose(&file);
+}
+
+void ColumnarEvaluate(const columnar_file_t *jobs, const calc_mode_t mode, uint64_t *values, uint8_t *flags) {
+    const size_t num_records = jobs->header->num_records;
+
+    for (size_t block = 0; block < NumBlocks(num_records); block++) {
+        const size_t begin = block * COLUMNAR_BLOCK_SIZE;
+        const size_t count = num_records - begin < COLUMNAR_BLOCK_SIZE ? num_records - begin : COLUMNAR_BLOCK_SIZE;
+        const uint8_t op = jobs->block_ops[block];
+
+        if (op < LAST_OPERATION) {
+            EvaluateHomogeneous(mode, (operation_t) op, &jobs->arg0[begin], &jobs->arg1[begin], &values[begin],
+                                &flags[begin], count);
+        } else {
+            EvaluateMixed(mode, &jobs->ops[begin], &jobs->arg0[begin], &jobs->arg1[begin], &values[begin],
+                          &flags[begin], count);
+        }
+    }
+}
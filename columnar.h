@@ -0,0 +1,95 @@
+#ifndef COLUMNAR_H
+#define COLUMNAR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "batch.h"
+#include "calc.h"
+
+// ------------------------------
+// defines
+// ------------------------------
+
+#define COLUMNAR_MAGIC "LSWCOL\0\0"
+#define COLUMNAR_VERSION 1
+/* every array starts at multiple of cache line */
+#define COLUMNAR_ALIGNMENT 64
+#define COLUMNAR_BLOCK_SIZE 4096
+/* block_ops entry of block mixing several operations */
+#define COLUMNAR_MIXED_BLOCK 0xff
+
+/*
+ * Binary batch file, all integers in host byte order.
+ *
+ * Jobs file:    header | arg0[n] u64 | arg1[n] u64 | op[n] u8 | block_ops[ceil(n / block_size)] u8
+ * Results file: header | value[n] u64 | flags[n] u8
+ *
+ * Arrays are aligned to COLUMNAR_ALIGNMENT. Values hold raw bit patterns of the number mode
+ * in the header. block_ops[i] is the operation shared by all records of block i,
+ * or COLUMNAR_MIXED_BLOCK, so that evaluation can run op-specialized loops over whole blocks.
+ */
+typedef enum ColumnarKind {
+    COLUMNAR_KIND_JOBS = 0,
+    COLUMNAR_KIND_RESULTS,
+    LAST_COLUMNAR_KIND
+} columnar_kind_t;
+
+typedef struct ColumnarHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t kind;
+    uint32_t number_mode;
+    uint32_t frac_bits;
+    uint64_t modulus;
+    uint64_t num_records;
+    uint32_t block_size;
+    uint32_t reserved[5];
+} columnar_header_t;
+
+_Static_assert(sizeof(columnar_header_t) == COLUMNAR_ALIGNMENT, "Header must keep first array aligned");
+
+/* mapped file, array pointers of the other kind are NULL */
+typedef struct ColumnarFile {
+    int fd;
+    void *base;
+    size_t size;
+    columnar_header_t *header;
+
+    uint64_t *arg0;
+    uint64_t *arg1;
+    uint8_t *ops;
+    uint8_t *block_ops;
+
+    uint64_t *values;
+    uint8_t *flags;
+} columnar_file_t;
+
+// ------------------------------
+// Function definitions
+// ------------------------------
+
+/* True when regular file at path starts with columnar magic, other files are left unread */
+bool ColumnarProbe(const char *path);
+
+/* Maps existing file read-only, returns negative value when it is missing or malformed */
+int ColumnarOpen(columnar_file_t *file, const char *path);
+
+/* Creates file of final size and maps it for writing, arrays are zeroed */
+int ColumnarCreate(columnar_file_t *file, const char *path, calc_mode_t mode, columnar_kind_t kind,
+                   size_t num_records);
+
+/* Unmaps and closes the file, returns negative value when written data could not be flushed */
+int ColumnarClose(columnar_file_t *file);
+
+/* True when the file was written for the same number mode */
+bool ColumnarMatchesMode(const columnar_file_t *file, calc_mode_t mode);
+
+/* Text converter - stores parsed records into jobs file */
+int ColumnarWriteJobs(const char *path, calc_mode_t mode, const batch_record_t *records, size_t count);
+
+/* Evaluates jobs into value and flag arrays of num_records entries each */
+void ColumnarEvaluate(const columnar_file_t *jobs, calc_mode_t mode, uint64_t *values, uint8_t *flags);
+
+#endif // COLUMNAR_H
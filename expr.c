@@ -0,0 +1,534 @@
+#include "expr.h"
+
+#include <string.h>
+
+// ------------------------------
+// defines
+// ------------------------------
+
+/* operator stack entry of unary minus in infix expressions */
+#define UNARY_MINUS '~'
+
+typedef enum TokenKind {
+    TOKEN_NUMBER = 0,
+    TOKEN_VAR,
+    TOKEN_OPERATOR,
+    TOKEN_LEFT_PAREN,
+    TOKEN_RIGHT_PAREN,
+    TOKEN_END,
+    LAST_TOKEN_KIND
+} token_kind_t;
+
+typedef struct Token {
+    token_kind_t kind;
+    /* number value, variable index or operator character */
+    uint64_t value;
+} token_t;
+
+// ------------------------------
+// Static helpers
+// ------------------------------
+
+static bool IsDigit(const char c) {
+    return c >= '0' && c <= '9';
+}
+
+static bool IsNameChar(const char c) {
+    return IsDigit(c) || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static const char *NextToken(const calc_mode_t mode, const char **cur, token_t *token) {
+    const char *str = *cur;
+    while (*str == ' ' || *str == '\t') {
+        str++;
+    }
+
+    if (*str == '\0' || *str == '\n' || *str == '\r') {
+        token->kind = TOKEN_END;
+        *cur = str;
+        return NULL;
+    }
+
+    if (IsDigit(*str) || *str == '.') {
+        const char *end = CalcParseValue(mode, str, &token->value);
+        if (end == NULL) {
+            return "Malformed constant";
+        }
+
+        token->kind = TOKEN_NUMBER;
+        *cur = end;
+        return NULL;
+    }
+
+    if (*str >= 'a' && *str < 'a' + EXPR_MAX_VARS && !IsNameChar(str[1])) {
+        token->kind = TOKEN_VAR;
+        token->value = (uint64_t) (*str - 'a');
+        *cur = str + 1;
+        return NULL;
+    }
+
+    switch (*str) {
+        case '+':
+        case '-':
+        case '*':
+        case '/':
+        case UNARY_MINUS:
+            token->kind = TOKEN_OPERATOR;
+            break;
+        case '(':
+            token->kind = TOKEN_LEFT_PAREN;
+            break;
+        case ')':
+            token->kind = TOKEN_RIGHT_PAREN;
+            break;
+        default:
+            return "Unknown token";
+    }
+
+    token->value = (uint64_t) *str;
+    *cur = str + 1;
+    return NULL;
+}
+
+static const char *EmitInstruction(expr_program_t *program, size_t *depth, const expr_opcode_t opcode,
+                                   const uint8_t operand) {
+    const bool has_operand = opcode == EXPR_OP_LOAD_VAR || opcode == EXPR_OP_LOAD_CONST;
+
+    /* last byte is reserved for EXPR_OP_END */
+    if (program->code_len + 1 + has_operand >= EXPR_MAX_CODE) {
+        return "Expression too long";
+    }
+
+    switch (opcode) {
+        case EXPR_OP_LOAD_VAR:
+        case EXPR_OP_LOAD_CONST:
+            if (*depth == EXPR_MAX_STACK) {
+                return "Expression nested too deep";
+            }
+            (*depth)++;
+            break;
+        case EXPR_OP_NEG:
+            if (*depth < 1) {
+                return "Missing operand";
+            }
+            break;
+        case EXPR_OP_ADD:
+        case EXPR_OP_SUB:
+        case EXPR_OP_MUL:
+        case EXPR_OP_DIV:
+            if (*depth < 2) {
+                return "Missing operand";
+            }
+            (*depth)--;
+            break;
+        case EXPR_OP_END:
+        case LAST_EXPR_OP:
+            return "Invalid opcode";
+    }
+
+    program->code[program->code_len++] = (uint8_t) opcode;
+    if (has_operand) {
+        program->code[program->code_len++] = operand;
+    }
+
+    if (*depth > program->max_stack) {
+        program->max_stack = *depth;
+    }
+
+    return NULL;
+}
+
+static const char *EmitOperand(expr_program_t *program, size_t *depth, const token_t *token) {
+    if (token->kind == TOKEN_VAR) {
+        if (token->value + 1 > program->num_vars) {
+            program->num_vars = token->value + 1;
+        }
+
+        return EmitInstruction(program, depth, EXPR_OP_LOAD_VAR, (uint8_t) token->value);
+    }
+
+    /* equal constants share pool slot */
+    size_t idx = 0;
+    while (idx < program->num_consts && program->consts[idx] != token->value) {
+        idx++;
+    }
+
+    if (idx == program->num_consts) {
+        if (idx == EXPR_MAX_CONSTS) {
+            return "Too many constants";
+        }
+
+        program->consts[program->num_consts++] = token->value;
+    }
+
+    return EmitInstruction(program, depth, EXPR_OP_LOAD_CONST, (uint8_t) idx);
+}
+
+static const char *EmitOperator(expr_program_t *program, size_t *depth, const char symbol) {
+    switch (symbol) {
+        case '+':
+            return EmitInstruction(program, depth, EXPR_OP_ADD, 0);
+        case '-':
+            return EmitInstruction(program, depth, EXPR_OP_SUB, 0);
+        case '*':
+            return EmitInstruction(program, depth, EXPR_OP_MUL, 0);
+        case '/':
+            return EmitInstruction(program, depth, EXPR_OP_DIV, 0);
+        case UNARY_MINUS:
+            return EmitInstruction(program, depth, EXPR_OP_NEG, 0);
+        default:
+            return "Unknown operator";
+    }
+}
+
+static int Precedence(const char symbol) {
+    switch (symbol) {
+        case '+':
+        case '-':
+            return 1;
+        case '*':
+        case '/':
+            return 2;
+        case UNARY_MINUS:
+            return 3;
+        default:
+            return 0;
+    }
+}
+
+static const char *CompileRpn(expr_program_t *program, const char *text, size_t *depth) {
+    const char *cur = text;
+    token_t token;
+
+    for (;;) {
+        const char *error = NextToken(program->mode, &cur, &token);
+        if (error != NULL) {
+            return error;
+        }
+
+        switch (token.kind) {
+            case TOKEN_NUMBER:
+            case TOKEN_VAR:
+                error = EmitOperand(program, depth, &token);
+                break;
+            case TOKEN_OPERATOR:
+                error = EmitOperator(program, depth, (char) token.value);
+                break;
+            case TOKEN_END:
+                return NULL;
+            case TOKEN_LEFT_PAREN:
+            case TOKEN_RIGHT_PAREN:
+            case LAST_TOKEN_KIND:
+                return "Parentheses are not allowed in RPN";
+        }
+
+        if (error != NULL) {
+            return error;
+        }
+    }
+}
+
+static const char *CompileInfix(expr_program_t *program, const char *text, size_t *depth) {
+    /* shunting-yard, operators are emitted as soon as they are popped */
+    char operators[EXPR_MAX_STACK];
+    size_t num_operators = 0;
+    bool expect_operand = true;
+
+    const char *cur = text;
+    token_t token;
+
+    for (;;) {
+        const char *error = NextToken(program->mode, &cur, &token);
+        if (error != NULL) {
+            return error;
+        }
+
+        switch (token.kind) {
+            case TOKEN_NUMBER:
+            case TOKEN_VAR:
+                if (!expect_operand) {
+                    return "Missing operator";
+                }
+
+                error = EmitOperand(program, depth, &token);
+                expect_operand = false;
+                break;
+            case TOKEN_LEFT_PAREN:
+                if (!expect_operand) {
+                    return "Missing operator";
+                }
+
+                if (num_operators == EXPR_MAX_STACK) {
+                    return "Expression nested too deep";
+                }
+
+                operators[num_operators++] = '(';
+                break;
+            case TOKEN_RIGHT_PAREN:
+                if (expect_operand) {
+                    return "Missing operand";
+                }
+
+                while (num_operators > 0 && operators[num_operators - 1] != '(' && error == NULL) {
+                    error = EmitOperator(program, depth, operators[--num_operators]);
+                }
+
+                if (error == NULL && num_operators == 0) {
+                    return "Unbalanced parentheses";
+                }
+
+                num_operators--;
+                break;
+            case TOKEN_OPERATOR: {
+                char symbol = (char) token.value;
+
+                if (expect_operand) {
+                    /* prefix minus binds tighter than anything and is right associative */
+                    if (symbol != '-' && symbol != UNARY_MINUS) {
+                        return "Missing operand";
+                    }
+
+                    symbol = UNARY_MINUS;
+                } else {
+                    if (symbol == UNARY_MINUS) {
+                        return "Missing operator";
+                    }
+
+                    while (num_operators > 0 && Precedence(operators[num_operators - 1]) >= Precedence(symbol) &&
+                           error == NULL) {
+                        error = EmitOperator(program, depth, operators[--num_operators]);
+                    }
+                }
+
+                if (num_operators == EXPR_MAX_STACK) {
+                    return "Expression nested too deep";
+                }
+
+                operators[num_operators++] = symbol;
+                expect_operand = true;
+                break;
+            }
+            case TOKEN_END:
+                if (expect_operand) {
+                    return "Missing operand";
+                }
+
+                while (num_operators > 0 && error == NULL) {
+                    if (operators[num_operators - 1] == '(') {
+                        return "Unbalanced parentheses";
+                    }
+
+                    error = EmitOperator(program, depth, operators[--num_operators]);
+                }
+
+                return error;
+            case LAST_TOKEN_KIND:
+                return "Unknown token";
+        }
+
+        if (error != NULL) {
+            return error;
+        }
+    }
+}
+
+static uint64_t WalkNode(const expr_tree_t *tree, const expr_node_t *node, const uint64_t *record,
+                         uint32_t *flags) {
+    calc_result_t step;
+
+    switch (node->opcode) {
+        case EXPR_OP_ADD:
+        case EXPR_OP_SUB:
+        case EXPR_OP_MUL:
+        case EXPR_OP_DIV: {
+            const uint64_t a = WalkNode(tree, node->left, record, flags);
+            const uint64_t b = WalkNode(tree, node->right, record, flags);
+            step = CalcEvaluate(tree->program->mode, (operation_t) node->opcode, a, b);
+            break;
+        }
+        case EXPR_OP_NEG:
+            step = CalcEvaluate(tree->program->mode, SUBTRACTION, 0, WalkNode(tree, node->left, record, flags));
+            break;
+        case EXPR_OP_LOAD_VAR:
+            return record[node->operand];
+        case EXPR_OP_LOAD_CONST:
+            return tree->program->consts[node->operand];
+        case EXPR_OP_END:
+        case LAST_EXPR_OP:
+            return 0;
+    }
+
+    *flags |= step.flags;
+    return step.value;
+}
+
+/*
+ * Direct threaded interpreter: every handler jumps straight to the handler of the next opcode.
+ * One copy per number mode, so that CalcEvaluate folds to single arithmetic primitive and
+ * the only indirect branches left are the opcode dispatches.
+ */
+#define DEFINE_EXPR_VM(name, number_mode_value)                                                             \
+    static void name(const expr_program_t *program, const uint64_t *vars, const size_t stride,             \
+                     calc_result_t *results, const size_t count) {                                          \
+        static const void *kDispatch[LAST_EXPR_OP] = {                                                      \
+            [EXPR_OP_ADD] = &&op_add,                                                                       \
+            [EXPR_OP_SUB] = &&op_sub,                                                                       \
+            [EXPR_OP_MUL] = &&op_mul,                                                                       \
+            [EXPR_OP_DIV] = &&op_div,                                                                       \
+            [EXPR_OP_NEG] = &&op_neg,                                                                       \
+            [EXPR_OP_LOAD_VAR] = &&op_load_var,                                                             \
+            [EXPR_OP_LOAD_CONST] = &&op_load_const,                                                         \
+            [EXPR_OP_END] = &&op_end,                                                                       \
+        };                                                                                                  \
+        const calc_mode_t mode = {                                                                          \
+            .number_mode = (number_mode_value),                                                             \
+            .frac_bits = program->mode.frac_bits,                                                           \
+            .mod = program->mode.mod,                                                                       \
+        };                                                                                                  \
+                                                                                                            \
+        for (size_t i = 0; i < count; i++) {                                                                \
+            const uint64_t *record = vars + i * stride;                                                     \
+            const uint8_t *pc = program->code;                                                              \
+            uint64_t stack[EXPR_MAX_STACK];                                                                 \
+            size_t sp = 0;                                                                                  \
+            uint32_t flags = 0;                                                                             \
+            calc_result_t step;                                                                             \
+                                                                                                            \
+            goto *kDispatch[*pc++];                                                                         \
+                                                                                                            \
+        op_add:                                                                                             \
+            step = CalcEvaluate(mode, ADDITION, stack[sp - 2], stack[sp - 1]);                              \
+            goto binary_done;                                                                               \
+        op_sub:                                                                                             \
+            step = CalcEvaluate(mode, SUBTRACTION, stack[sp - 2], stack[sp - 1]);                           \
+            goto binary_done;                                                                               \
+        op_mul:                                                                                             \
+            step = CalcEvaluate(mode, MULTIPLICATION, stack[sp - 2], stack[sp - 1]);                        \
+            goto binary_done;                                                                               \
+        op_div:                                                                                             \
+            step = CalcEvaluate(mode, DIVISION, stack[sp - 2], stack[sp - 1]);                              \
+        binary_done:                                                                                        \
+            stack[--sp - 1] = step.value;                                                                   \
+            flags |= step.flags;                                                                            \
+            goto *kDispatch[*pc++];                                                                         \
+        op_neg:                                                                                             \
+            step = CalcEvaluate(mode, SUBTRACTION, 0, stack[sp - 1]);                                       \
+            stack[sp - 1] = step.value;                                                                     \
+            flags |= step.flags;                                                                            \
+            goto *kDispatch[*pc++];                                                                         \
+        op_load_var:                                                                                        \
+            stack[sp++] = record[*pc++];                                                                    \
+            goto *kDispatch[*pc++];                                                                         \
+        op_load_const:                                                                                      \
+            stack[sp++] = program->consts[*pc++];                                                           \
+            goto *kDispatch[*pc++];                                                                         \
+        op_end:                                                                                             \
+            results[i].value = stack[0];                                                                    \
+            results[i].flags = flags;                                                                       \
+        }                                                                                                   \
+    }
+
+DEFINE_EXPR_VM(RunUnsigned, NUMBER_MODE_UNSIGNED)
+DEFINE_EXPR_VM(RunSigned, NUMBER_MODE_SIGNED)
+DEFINE_EXPR_VM(RunFixed, NUMBER_MODE_FIXED)
+DEFINE_EXPR_VM(RunFloat, NUMBER_MODE_FLOAT)
+DEFINE_EXPR_VM(RunModular, NUMBER_MODE_MODULAR)
+
+// ------------------------------
+// Function implementations
+// ------------------------------
+
+const char *ExprCompile(expr_program_t *program, const calc_mode_t mode, const expr_syntax_t syntax,
+                        const char *text) {
+    memset(program, 0, sizeof(*program));
+    program->mode = mode;
+
+    size_t depth = 0;
+    const char *error = syntax == EXPR_SYNTAX_RPN
+                            ? CompileRpn(program, text, &depth)
+                            : CompileInfix(program, text, &depth);
+
+    if (error != NULL) {
+        return error;
+    }
+
+    if (depth != 1) {
+        return depth == 0 ? "Empty expression" : "Missing operator";
+    }
+
+    program->code[program->code_len++] = EXPR_OP_END;
+    return NULL;
+}
+
+void ExprEvaluate(const expr_program_t *program, const uint64_t *vars, const size_t stride, calc_result_t *results,
+                  const size_t count) {
+    switch (program->mode.number_mode) {
+        case NUMBER_MODE_SIGNED:
+            RunSigned(program, vars, stride, results, count);
+            break;
+        case NUMBER_MODE_FIXED:
+            RunFixed(program, vars, stride, results, count);
+            break;
+        case NUMBER_MODE_FLOAT:
+            RunFloat(program, vars, stride, results, count);
+            break;
+        case NUMBER_MODE_MODULAR:
+            RunModular(program, vars, stride, results, count);
+            break;
+        case NUMBER_MODE_UNSIGNED:
+        case LAST_NUMBER_MODE:
+            RunUnsigned(program, vars, stride, results, count);
+            break;
+    }
+}
+
+void ExprBuildTree(expr_tree_t *tree, const expr_program_t *program) {
+    const expr_node_t *stack[EXPR_MAX_STACK];
+    size_t sp = 0;
+    size_t num_nodes = 0;
+
+    tree->program = program;
+
+    /* compiled program is valid postfix, so the operand stack never under- or overflows */
+    for (const uint8_t *pc = program->code; *pc != EXPR_OP_END; pc++) {
+        expr_node_t *node = &tree->nodes[num_nodes++];
+        node->opcode = (expr_opcode_t) *pc;
+        node->operand = 0;
+        node->left = NULL;
+        node->right = NULL;
+
+        switch (node->opcode) {
+            case EXPR_OP_ADD:
+            case EXPR_OP_SUB:
+            case EXPR_OP_MUL:
+            case EXPR_OP_DIV:
+                node->right = stack[--sp];
+                node->left = stack[--sp];
+                break;
+            case EXPR_OP_NEG:
+                node->left = stack[--sp];
+                break;
+            case EXPR_OP_LOAD_VAR:
+            case EXPR_OP_LOAD_CONST:
+                node->operand = *++pc;
+                break;
+            case EXPR_OP_END:
+            case LAST_EXPR_OP:
+                break;
+        }
+
+        stack[sp++] = node;
+    }
+
+    tree->root = stack[0];
+}
+
+void ExprInterpret(const expr_tree_t *tree, const uint64_t *vars, const size_t stride, calc_result_t *results,
+                   const size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        uint32_t flags = 0;
+
+        results[i].value = WalkNode(tree, tree->root, vars + i * stride, &flags);
+        results[i].flags = flags;
+    }
+}
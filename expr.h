@@ -0,0 +1,98 @@
+#ifndef EXPR_H
+#define EXPR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "calc.h"
+
+// ------------------------------
+// defines
+// ------------------------------
+
+#define EXPR_MAX_CODE 256
+#define EXPR_MAX_CONSTS 32
+#define EXPR_MAX_STACK 32
+/* record fields are referenced as variables a, b, c, ... */
+#define EXPR_MAX_VARS 8
+
+/*
+ * Expressions are compiled once to bytecode and evaluated over many records.
+ *
+ * Infix syntax knows + - * /, parentheses and unary minus, e.g. "(a - 32) * 5 / 9".
+ * RPN syntax takes whitespace separated tokens, with ~ as negation, e.g. "a 32 - 5 * 9 /".
+ * Constants follow the number mode of the program.
+ *
+ * Bytecode is a stream of single byte opcodes, loads are followed by single byte index
+ * into the variables of the record or the constant pool.
+ */
+
+typedef enum ExprSyntax {
+    EXPR_SYNTAX_INFIX = 0,
+    EXPR_SYNTAX_RPN,
+    LAST_EXPR_SYNTAX
+} expr_syntax_t;
+
+typedef enum ExprOpcode {
+    /* arithmetic opcodes match operation_t */
+    EXPR_OP_ADD = ADDITION,
+    EXPR_OP_SUB = SUBTRACTION,
+    EXPR_OP_MUL = MULTIPLICATION,
+    EXPR_OP_DIV = DIVISION,
+    EXPR_OP_NEG,
+    EXPR_OP_LOAD_VAR,
+    EXPR_OP_LOAD_CONST,
+    EXPR_OP_END,
+    LAST_EXPR_OP
+} expr_opcode_t;
+
+typedef struct ExprProgram {
+    calc_mode_t mode;
+    uint8_t code[EXPR_MAX_CODE];
+    size_t code_len;
+    uint64_t consts[EXPR_MAX_CONSTS];
+    size_t num_consts;
+    /* highest referenced variable + 1, records must hold at least that many fields */
+    size_t num_vars;
+    size_t max_stack;
+} expr_program_t;
+
+/* Syntax tree node, one per instruction of the program */
+typedef struct ExprNode {
+    expr_opcode_t opcode;
+    /* variable or constant index of loads */
+    uint8_t operand;
+    const struct ExprNode *left;
+    const struct ExprNode *right;
+} expr_node_t;
+
+/* Tree walking interpreter of a compiled program, baseline the bytecode VM is measured against */
+typedef struct ExprTree {
+    const expr_program_t *program;
+    expr_node_t nodes[EXPR_MAX_CODE];
+    const expr_node_t *root;
+} expr_tree_t;
+
+// ------------------------------
+// Function definitions
+// ------------------------------
+
+/* Returns NULL on success, otherwise static error message */
+const char *ExprCompile(expr_program_t *program, calc_mode_t mode, expr_syntax_t syntax, const char *text);
+
+/*
+ * Evaluates program over count records, record i is vars[i * stride, i * stride + num_vars).
+ * Flags of all operations of a record are merged into its result.
+ */
+void ExprEvaluate(const expr_program_t *program, const uint64_t *vars, size_t stride, calc_result_t *results,
+                  size_t count);
+
+/* Builds syntax tree of compiled program, program has to outlive the tree */
+void ExprBuildTree(expr_tree_t *tree, const expr_program_t *program);
+
+/* Evaluates tree over records as ExprEvaluate does, walking it recursively for every record */
+void ExprInterpret(const expr_tree_t *tree, const uint64_t *vars, size_t stride, calc_result_t *results,
+                   size_t count);
+
+#endif // EXPR_H
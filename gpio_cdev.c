@@ -0,0 +1,170 @@
+#include "gpio_cdev.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include <linux/gpio.h>
+
+_Static_assert(GPIO_CDEV_MAX_LINES <= GPIO_V2_LINES_MAX, "Too many lines for single v2 request");
+_Static_assert(GPIO_CDEV_EVENT_BATCH > 0, "Event batch must not be empty");
+
+// ------------------------------
+// Static helpers
+// ------------------------------
+
+static int RequestLines(gpio_cdev_lines_t *lines, const int chip_fd, const int *offsets, const size_t num_lines,
+                        struct gpio_v2_line_request *req) {
+    if (num_lines == 0 || num_lines > GPIO_CDEV_MAX_LINES) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    strncpy(req->consumer, GPIO_CDEV_CONSUMER, sizeof(req->consumer) - 1);
+    req->num_lines = (uint32_t) num_lines;
+
+    for (size_t i = 0; i < num_lines; i++) {
+        req->offsets[i] = (uint32_t) offsets[i];
+        lines->offsets[i] = (uint32_t) offsets[i];
+    }
+
+    if (ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, req) < 0) {
+        return -1;
+    }
+
+    lines->fd = req->fd;
+    lines->num_lines = num_lines;
+
+    return 0;
+}
+
+static size_t LineIdxFromOffset(const gpio_cdev_lines_t *lines, const uint32_t offset) {
+    for (size_t i = 0; i < lines->num_lines; i++) {
+        if (lines->offsets[i] == offset) {
+            return i;
+        }
+    }
+
+    return lines->num_lines;
+}
+
+// ------------------------------
+// Function implementations
+// ------------------------------
+
+int GpioCdevOpenChip(const char *path) {
+    return open(path, O_RDWR | O_CLOEXEC);
+}
+
+void GpioCdevCloseChip(const int chip_fd) {
+    if (chip_fd >= 0) {
+        close(chip_fd);
+    }
+}
+
+int GpioCdevRequestInputs(gpio_cdev_lines_t *lines, const int chip_fd, const int *offsets, const size_t num_lines,
+                          const uint32_t debounce_us) {
+    struct gpio_v2_line_request req;
+    memset(&req, 0, sizeof(req));
+
+    req.config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EDGE_FALLING;
+
+    if (debounce_us > 0) {
+        req.config.num_attrs = 1;
+        req.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_DEBOUNCE;
+        req.config.attrs[0].attr.debounce_period_us = debounce_us;
+        req.config.attrs[0].mask = (num_lines >= 64) ? UINT64_MAX : (((uint64_t) 1 << num_lines) - 1);
+    }
+
+    req.event_buffer_size = (uint32_t) (num_lines * GPIO_CDEV_EVENT_BATCH);
+
+    return RequestLines(lines, chip_fd, offsets, num_lines, &req);
+}
+
+int GpioCdevRequestOutputs(gpio_cdev_lines_t *lines, const int chip_fd, const int *offsets, const size_t num_lines,
+                           const uint64_t initial_bits) {
+    struct gpio_v2_line_request req;
+    memset(&req, 0, sizeof(req));
+
+    req.config.flags = GPIO_V2_LINE_FLAG_OUTPUT;
+
+    /* initial values are applied atomically with the request, so lines never glitch */
+    req.config.num_attrs = 1;
+    req.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+    req.config.attrs[0].attr.values = initial_bits;
+    req.config.attrs[0].mask = (num_lines >= 64) ? UINT64_MAX : (((uint64_t) 1 << num_lines) - 1);
+
+    return RequestLines(lines, chip_fd, offsets, num_lines, &req);
+}
+
+void GpioCdevRelease(gpio_cdev_lines_t *lines) {
+    if (lines->num_lines > 0) {
+        close(lines->fd);
+    }
+
+    lines->fd = -1;
+    lines->num_lines = 0;
+}
+
+int GpioCdevSetValues(const gpio_cdev_lines_t *lines, const uint64_t mask, const uint64_t bits) {
+    struct gpio_v2_line_values values = {
+        .bits = bits,
+        .mask = mask,
+    };
+
+    return ioctl(lines->fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &values);
+}
+
+int GpioCdevGetValues(const gpio_cdev_lines_t *lines, const uint64_t mask, uint64_t *bits) {
+    struct gpio_v2_line_values values = {
+        .bits = 0,
+        .mask = mask,
+    };
+
+    if (ioctl(lines->fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0) {
+        return -1;
+    }
+
+    *bits = values.bits;
+    return 0;
+}
+
+ssize_t GpioCdevReadEvents(const gpio_cdev_lines_t *lines, gpio_cdev_event_t *events, size_t max_events) {
+    struct gpio_v2_line_event raw[GPIO_CDEV_EVENT_BATCH];
+
+    if (max_events > GPIO_CDEV_EVENT_BATCH) {
+        max_events = GPIO_CDEV_EVENT_BATCH;
+    }
+
+    ssize_t ret;
+    do {
+        ret = read(lines->fd, raw, max_events * sizeof(raw[0]));
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret < 0) {
+        return -1;
+    }
+
+    /* kernel always hands out whole events */
+    const size_t num_events = (size_t) ret / sizeof(raw[0]);
+    size_t num_valid = 0;
+
+    for (size_t i = 0; i < num_events; i++) {
+        const size_t line_idx = LineIdxFromOffset(lines, raw[i].offset);
+
+        if (line_idx == lines->num_lines) {
+            continue;
+        }
+
+        events[num_valid].line_idx = line_idx;
+        events[num_valid].rising = raw[i].id == GPIO_V2_LINE_EVENT_RISING_EDGE;
+        events[num_valid].timestamp_ns = raw[i].timestamp_ns;
+        events[num_valid].seqno = raw[i].seqno;
+        events[num_valid].line_seqno = raw[i].line_seqno;
+        num_valid++;
+    }
+
+    return (ssize_t) num_valid;
+}
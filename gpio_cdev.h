@@ -0,0 +1,70 @@
+#ifndef GPIO_CDEV_H
+#define GPIO_CDEV_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// ------------------------------
+// defines
+// ------------------------------
+
+/* Upper bound of lines in a single request, kept small so that the handle can live in static state */
+#define GPIO_CDEV_MAX_LINES 8
+
+/* Number of events fetched from the kernel with single read() call */
+#define GPIO_CDEV_EVENT_BATCH 16
+
+#define GPIO_CDEV_CONSUMER "linsw"
+
+/*
+ * Thin wrapper over the GPIO character-device v2 uAPI (linux/gpio.h).
+ * Every line of the request is addressed by its index in the request, so
+ * values are passed around as bitmasks where bit i corresponds to offsets[i].
+ *
+ * All functions return negative value on failure and leave errno set by the failing syscall.
+ * Nothing in here allocates memory.
+ */
+typedef struct GpioCdevLines {
+    int fd;
+    size_t num_lines;
+    uint32_t offsets[GPIO_CDEV_MAX_LINES];
+} gpio_cdev_lines_t;
+
+typedef struct GpioCdevEvent {
+    size_t line_idx;
+    bool rising;
+    uint64_t timestamp_ns;
+    uint32_t seqno;
+    uint32_t line_seqno;
+} gpio_cdev_event_t;
+
+// ------------------------------
+// Function definitions
+// ------------------------------
+
+int GpioCdevOpenChip(const char *path);
+
+void GpioCdevCloseChip(int chip_fd);
+
+/* Requests lines as inputs with edge detection on both edges and in-kernel debounce (0 disables it) */
+int GpioCdevRequestInputs(gpio_cdev_lines_t *lines, int chip_fd, const int *offsets, size_t num_lines,
+                          uint32_t debounce_us);
+
+/* Requests lines as outputs, initial_bits holds starting values of the lines */
+int GpioCdevRequestOutputs(gpio_cdev_lines_t *lines, int chip_fd, const int *offsets, size_t num_lines,
+                           uint64_t initial_bits);
+
+void GpioCdevRelease(gpio_cdev_lines_t *lines);
+
+/* Sets all lines selected by mask in one ioctl */
+int GpioCdevSetValues(const gpio_cdev_lines_t *lines, uint64_t mask, uint64_t bits);
+
+/* Reads all lines selected by mask in one ioctl */
+int GpioCdevGetValues(const gpio_cdev_lines_t *lines, uint64_t mask, uint64_t *bits);
+
+/* Drains up to max_events pending edge events, returns number of events read */
+ssize_t GpioCdevReadEvents(const gpio_cdev_lines_t *lines, gpio_cdev_event_t *events, size_t max_events);
+
+#endif // GPIO_CDEV_H
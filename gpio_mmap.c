@@ -0,0 +1,74 @@
+#include "gpio_mmap.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// ------------------------------
+// Function implementations
+// ------------------------------
+
+int GpioMmapOpen(gpio_mmap_regs_t *regs, const char *path) {
+    regs->base = NULL;
+    regs->fd = open(path, O_RDWR | O_SYNC | O_CLOEXEC);
+
+    if (regs->fd < 0) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(regs->fd, &st) < 0) {
+        close(regs->fd);
+        return -1;
+    }
+
+    /* fake register page must be large enough to be mapped */
+    regs->fake = S_ISREG(st.st_mode);
+    if (regs->fake && st.st_size < GPIO_MMAP_BLOCK_SIZE && ftruncate(regs->fd, GPIO_MMAP_BLOCK_SIZE) < 0) {
+        close(regs->fd);
+        return -1;
+    }
+
+    void *base = mmap(NULL, GPIO_MMAP_BLOCK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, regs->fd, 0);
+    if (base == MAP_FAILED) {
+        const int err = errno;
+        close(regs->fd);
+        errno = err;
+        return -1;
+    }
+
+    regs->base = base;
+    return 0;
+}
+
+void GpioMmapClose(gpio_mmap_regs_t *regs) {
+    if (regs->base == NULL) {
+        return;
+    }
+
+    munmap((void *) regs->base, GPIO_MMAP_BLOCK_SIZE);
+    close(regs->fd);
+
+    regs->base = NULL;
+    regs->fd = -1;
+}
+
+int GpioMmapSetOutput(const gpio_mmap_regs_t *regs, const int pin) {
+    if (pin < 0 || pin > GPIO_MMAP_MAX_PIN) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* every GPFSEL register holds function of 10 pins */
+    const int reg = GPIO_MMAP_GPFSEL0 + pin / 10;
+    const int shift = (pin % 10) * GPIO_MMAP_FSEL_BITS;
+
+    uint32_t fsel = regs->base[reg];
+    fsel &= ~((uint32_t) GPIO_MMAP_FSEL_MASK << shift);
+    fsel |= (uint32_t) GPIO_MMAP_FSEL_OUTPUT << shift;
+    regs->base[reg] = fsel;
+
+    return 0;
+}
@@ -0,0 +1,74 @@
+#ifndef GPIO_MMAP_H
+#define GPIO_MMAP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// ------------------------------
+// defines
+// ------------------------------
+
+#define GPIO_MMAP_DEV_PATH "/dev/gpiomem"
+#define GPIO_MMAP_BLOCK_SIZE 4096
+
+/* BCM283x register offsets, expressed in 32-bit words from the block start */
+#define GPIO_MMAP_GPFSEL0 (0x00 / 4)
+#define GPIO_MMAP_GPSET0 (0x1C / 4)
+#define GPIO_MMAP_GPCLR0 (0x28 / 4)
+#define GPIO_MMAP_GPLEV0 (0x34 / 4)
+
+#define GPIO_MMAP_FSEL_BITS 3
+#define GPIO_MMAP_FSEL_MASK 0b111
+#define GPIO_MMAP_FSEL_OUTPUT 0b001
+
+/* only first register bank is supported, which covers every pin on the 40-pin header */
+#define GPIO_MMAP_MAX_PIN 31
+
+/*
+ * Direct access to BCM283x GPIO register block. The block is usually mapped from /dev/gpiomem,
+ * but any regular file can be passed instead - it is then treated as a fake register page:
+ * writes to SET/CLR registers land in the file and are mirrored into LEV register,
+ * so the result of every bank write can be inspected from outside the process.
+ */
+typedef struct GpioMmapRegs {
+    volatile uint32_t *base;
+    int fd;
+    bool fake;
+} gpio_mmap_regs_t;
+
+// ------------------------------
+// Function definitions
+// ------------------------------
+
+/* Returns negative value on failure with errno set */
+int GpioMmapOpen(gpio_mmap_regs_t *regs, const char *path);
+
+void GpioMmapClose(gpio_mmap_regs_t *regs);
+
+/* Switches pin function to output, returns negative value for unsupported pin */
+int GpioMmapSetOutput(const gpio_mmap_regs_t *regs, int pin);
+
+// ------------------------------
+// Inline implementations
+// ------------------------------
+
+/* Sets and clears given pins with single write to each register */
+static inline void GpioMmapWrite(const gpio_mmap_regs_t *regs, const uint32_t set_mask, const uint32_t clr_mask) {
+    if (set_mask) {
+        regs->base[GPIO_MMAP_GPSET0] = set_mask;
+    }
+
+    if (clr_mask) {
+        regs->base[GPIO_MMAP_GPCLR0] = clr_mask;
+    }
+
+    if (regs->fake) {
+        regs->base[GPIO_MMAP_GPLEV0] = (regs->base[GPIO_MMAP_GPLEV0] | set_mask) & ~clr_mask;
+    }
+}
+
+static inline uint32_t GpioMmapLevels(const gpio_mmap_regs_t *regs) {
+    return regs->base[GPIO_MMAP_GPLEV0];
+}
+
+#endif // GPIO_MMAP_H
@@ -0,0 +1,214 @@
+#define _GNU_SOURCE
+
+#include "handoff.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+// ------------------------------
+// Static helpers
+// ------------------------------
+
+static int FillAddress(struct sockaddr_un *addr, const char *path) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+static void CloseReceivedFds(struct msghdr *msg) {
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+
+        const size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        const int *fds = (const int *) CMSG_DATA(cmsg);
+
+        for (size_t i = 0; i < count; i++) {
+            close(fds[i]);
+        }
+    }
+}
+
+// ------------------------------
+// Function implementations
+// ------------------------------
+
+int HandoffListen(const char *path) {
+    struct sockaddr_un addr;
+    if (FillAddress(&addr, path) < 0) {
+        return -1;
+    }
+
+    const int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    /* predecessor never unlinks its socket, it is still open there while the successor starts */
+    unlink(path);
+
+    if (bind(fd, (const struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, 1) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int HandoffSend(const int listen_fd, const int *fds, const size_t num_fds, const void *state,
+                const size_t state_size, const uint32_t version) {
+    if (num_fds > HANDOFF_MAX_FDS) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    const int sock = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (sock < 0) {
+        /* connection gone before it was accepted */
+        return errno == EAGAIN || errno == ECONNABORTED ? 0 : -1;
+    }
+
+    handoff_header_t header = {
+        .version = version,
+        .num_fds = (uint32_t) num_fds,
+        .state_size = state_size,
+    };
+    memcpy(header.magic, HANDOFF_MAGIC, sizeof(header.magic));
+
+    struct iovec iov[2] = {
+        {.iov_base = &header, .iov_len = sizeof(header)},
+        {.iov_base = (void *) state, .iov_len = state_size},
+    };
+
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+        struct cmsghdr align;
+    } control;
+
+    struct msghdr msg = {
+        .msg_iov = iov,
+        .msg_iovlen = 2,
+        .msg_control = control.buf,
+        .msg_controllen = CMSG_SPACE(sizeof(int) * num_fds),
+    };
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * num_fds);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * num_fds);
+
+    /* successor stuck before answering must not stall the running process for good */
+    const struct timeval timeout = {
+        .tv_sec = HANDOFF_ACK_TIMEOUT_MS / 1000,
+        .tv_usec = (HANDOFF_ACK_TIMEOUT_MS % 1000) * 1000,
+    };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    int ret = -1;
+    if (sendmsg(sock, &msg, MSG_NOSIGNAL) == (ssize_t) (sizeof(header) + state_size)) {
+        char ack = 0;
+        ret = recv(sock, &ack, sizeof(ack), 0) == (ssize_t) sizeof(ack) && ack != 0 ? 1 : 0;
+    }
+
+    /* late accept is never committed, successor sees the close and leaves the lines to us */
+    if (ret == 1) {
+        const char commit = 1;
+        ret = send(sock, &commit, sizeof(commit), MSG_NOSIGNAL) == (ssize_t) sizeof(commit) ? 1 : 0;
+    }
+
+    close(sock);
+    return ret;
+}
+
+int HandoffReceive(const char *path, int *fds, const size_t num_fds, void *state, const size_t state_size,
+                   const uint32_t version) {
+    struct sockaddr_un addr;
+    if (num_fds > HANDOFF_MAX_FDS || FillAddress(&addr, path) < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    const int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        return -1;
+    }
+
+    if (connect(sock, (const struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        const int error = errno;
+        close(sock);
+        errno = error;
+        return -1;
+    }
+
+    handoff_header_t header;
+    struct iovec iov[2] = {
+        {.iov_base = &header, .iov_len = sizeof(header)},
+        {.iov_base = state, .iov_len = state_size},
+    };
+
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+        struct cmsghdr align;
+    } control;
+
+    struct msghdr msg = {
+        .msg_iov = iov,
+        .msg_iovlen = 2,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+
+    const ssize_t received = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    const struct cmsghdr *cmsg = received > 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+
+    /* seqpacket keeps the message whole, anything longer or shorter is other layout */
+    const bool valid = received == (ssize_t) (sizeof(header) + state_size) &&
+                       (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) == 0 &&
+                       memcmp(header.magic, HANDOFF_MAGIC, sizeof(header.magic)) == 0 &&
+                       header.version == version && header.state_size == state_size &&
+                       header.num_fds == num_fds && cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET &&
+                       cmsg->cmsg_type == SCM_RIGHTS && cmsg->cmsg_len == CMSG_LEN(sizeof(int) * num_fds);
+
+    if (!valid) {
+        if (received > 0) {
+            CloseReceivedFds(&msg);
+        }
+
+        HandoffFinish(sock, false);
+        errno = EPROTO;
+        return -1;
+    }
+
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * num_fds);
+    return sock;
+}
+
+int HandoffFinish(const int sock, const bool accepted) {
+    const char ack = accepted ? 1 : 0;
+    bool done = send(sock, &ack, sizeof(ack), MSG_NOSIGNAL) == (ssize_t) sizeof(ack);
+
+    /* commit follows the accept right away, close without it means predecessor kept serving */
+    if (done && accepted) {
+        char commit = 0;
+        ssize_t received;
+
+        while ((received = recv(sock, &commit, sizeof(commit), 0)) < 0 && errno == EINTR) {}
+        done = received == (ssize_t) sizeof(commit) && commit != 0;
+    }
+
+    close(sock);
+    return done ? 0 : -1;
+}
@@ -0,0 +1,60 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// ------------------------------
+// defines
+// ------------------------------
+
+#define HANDOFF_MAGIC "LSWHOFF\0"
+#define HANDOFF_MAX_FDS 8
+/* running process waits that long for the successor to accept the state, then keeps serving */
+#define HANDOFF_ACK_TIMEOUT_MS 1000
+
+/*
+ * Single seqpacket message carries the header, opaque state of state_size bytes and num_fds
+ * descriptors as SCM_RIGHTS. The successor answers with single byte, non-zero accepts the state.
+ * Only the sender decides: accept received in time is confirmed with single commit byte, after which
+ * the sender stops serving. Without the commit, i.e. on decline, timeout or broken connection,
+ * the sender keeps ownership and the successor must not touch the received fds.
+ */
+typedef struct HandoffHeader {
+    char magic[8];
+    /* layout of the opaque state, both sides must agree on it */
+    uint32_t version;
+    uint32_t num_fds;
+    uint64_t state_size;
+} handoff_header_t;
+
+// ------------------------------
+// Function definitions
+// ------------------------------
+
+/* Binds non-blocking listening socket at path, replacing socket left there by predecessor */
+int HandoffListen(const char *path);
+
+/*
+ * Accepts pending successor on listening socket and passes fds and state to it.
+ * Returns 1 when the successor accepted and got the commit, so the caller has to stop serving,
+ * 0 when it declined, went away or did not answer in time, negative value on error.
+ */
+int HandoffSend(int listen_fd, const int *fds, size_t num_fds, const void *state, size_t state_size,
+                uint32_t version);
+
+/*
+ * Connects to predecessor listening at path and receives exactly num_fds fds and state_size bytes of state.
+ * Returns connected socket to be answered by HandoffFinish, negative value when nobody listens
+ * (errno ENOENT or ECONNREFUSED) or the message does not match (errno EPROTO, already declined).
+ */
+int HandoffReceive(const char *path, int *fds, size_t num_fds, void *state, size_t state_size, uint32_t version);
+
+/*
+ * Tells predecessor whether the state is accepted and closes the connection. Accepting waits for
+ * the commit of predecessor, returns 0 only when it was received and the fds may be used.
+ */
+int HandoffFinish(int sock, bool accepted);
+
+#endif // HANDOFF_H
@@ -1,20 +1,36 @@
 #include <assert.h>
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <poll.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <time.h>  // For clock_gettime()
 #include <sys/time.h>
 
 #include <gpio.h>
 
+#include "batch.h"
+#include "calc.h"
+#include "gpio_cdev.h"
+#include "gpio_mmap.h"
+#include "handoff.h"
+#include "numfmt.h"
+#include "panels.h"
+#include "pwm.h"
+#include "snapshot.h"
+#include "workpool.h"
+
 // ------------------------------
 // defines
 // ------------------------------
 
 #define NUM_BUTTONS 4
 #define NUM_LEDS 4
+#define ALL_LEDS_MASK (((uint64_t) 1 << NUM_LEDS) - 1)
 #define NUM_ARGS 2
 #define GPIO_SYS_PATH "/dev/gpiochip0"
 
@@ -24,7 +40,71 @@
 #define PRESENTATION_BLANK_LEDS_MS 300
 #define PRESENTATION_BIT_TIME_MS 2000
 
+/* 64 bit result shown bit by bit plus some headroom for marker frames */
+#define DISPLAY_MAX_FRAMES 128
+
+/* run length frame blinks the count, so it can't be mistaken for a bit frame */
+#define PRESENTATION_COUNT_BLINKS 3
+#define PRESENTATION_COUNT_ON_MS 400
+#define PRESENTATION_COUNT_OFF_MS 200
+#define RLE_MAX_RUN_PER_FRAME ALL_LEDS_MASK
+
+#define NIBBLE_BITS 4
+/* binary entry appends at most that many bits, signed magnitudes keep int64_t range */
+#define ARG_MAX_BITS 64
+#define SIGNED_ARG_MAX_BITS 63
+#define NUM_RESULT_NIBBLES (64 / NIBBLE_BITS)
+
+/* 2-bit gray counter on leds 2 and 3 marks frame boundaries in min-toggle encoding */
+#define GRAY_CLOCK_SHIFT 2
+/* counter skips 00, which together with 0 bit would be the blank bank */
+#define GRAY_CLOCK_STATES 3
+#define GRAY_DATA_MASK 0b0011
+
+/* fixed point and float results are shown as hex nibble groups */
+#define FLOAT_EXPONENT_NIBBLES 3
+#define FLOAT_MANTISSA_NIBBLES 13
+#define PRESENTATION_SEPARATOR_MS 300
+
+/* sign frame patterns, overflowed result blinks its sign frame */
+#define SIGN_NEGATIVE_BANK 0b1001
+#define SIGN_POSITIVE_BANK 0b0110
+#define PRESENTATION_SIGN_BLINKS 4
+/* decimal display shows digit 0 as all leds lit */
+#define DECIMAL_ZERO_NIBBLE 0b1111
+
+/* decimal entry picks digits from a window of three, opened at 0 or 5 and moved by its width */
+#define DECIMAL_WINDOW_WIDTH 3
+#define DECIMAL_HIGH_WINDOW 5
+#define PRESENTATION_ZERO_BLINKS 5
+
+/* rpn mode keeps operands on a stack, results are displayed only on request */
+#define RPN_DEFAULT_DEPTH 8
+#define RPN_MAX_DEPTH 16
+
+/* macro steps hold operation and constant operand, operations are packed MACRO_OP_BITS each */
+#define MACRO_MAX_STEPS 16
+#define MACRO_OP_BITS 2
+#define MACRO_OP_MASK ((1u << MACRO_OP_BITS) - 1)
+
+#define PWM_DEFAULT_LEVELS 4
+#define PWM_LEVEL_BITS 2
+
 #define DEBOUNCE_THRESHOLD_MS 200
+/* line must stay stable that long before kernel reports an edge, used by cdev backend only */
+#define KERNEL_DEBOUNCE_US 10000
+
+#define GPIO_BENCH_DEFAULT_ITERATIONS 100000
+
+/* leds are blanked after that long without any button edge */
+#define IDLE_DEFAULT_TIMEOUT_S 60
+
+/* bumped whenever handoff_state_t changes, successor with other layout is turned away */
+#define HANDOFF_STATE_VERSION 2
+/* button and led line requests */
+#define HANDOFF_NUM_FDS 2
+/* bumped whenever calculator_state_t changes, snapshot of other layout is started over */
+#define SNAPSHOT_STATE_VERSION 1
 
 #define CHECKED_RUN(run) if ((run) < 0) { \
     TRACE("Error running %s!", #run); \
@@ -45,24 +125,92 @@ typedef enum CalculatorPhase {
     ARG_INPUT_SECOND,
     ARG_INPUT_OPERATION,
     ARG_DISPLAY,
+    RESULT_BROWSE,
+    RPN_COMMAND,
+    MACRO_COMMAND,
     LAST_PHASE
 } calculator_phase_t;
 
-typedef enum Operation {
-    ADDITION = 0,
-    SUBTRACTION,
-    MULTIPLICATION,
-    DIVISION,
-    LAST_OPERATION
-} operation_t;
+typedef enum GpioBackend {
+    GPIO_BACKEND_CDEV = 0,
+    GPIO_BACKEND_PERIPHERY,
+    GPIO_BACKEND_MMAP, /* leds only, buttons need kernel edge detection */
+    LAST_GPIO_BACKEND
+} gpio_backend_t;
+
+typedef enum DisplayMode {
+    DISPLAY_MODE_BINARY = 0,
+    DISPLAY_MODE_PWM,
+    DISPLAY_MODE_RLE,
+    DISPLAY_MODE_DECIMAL,
+    DISPLAY_MODE_DELTA,
+    LAST_DISPLAY_MODE
+} display_mode_t;
+
+typedef enum FrameEncoding {
+    FRAME_ENCODING_PLAIN = 0,
+    FRAME_ENCODING_MIN_TOGGLE,
+    LAST_FRAME_ENCODING
+} frame_encoding_t;
+
+typedef enum FrameKind {
+    FRAME_BIT = 0, /* value: single result bit */
+    FRAME_LEVELS, /* value: brightness of led i packed at bits [i * PWM_LEVEL_BITS, (i + 1) * PWM_LEVEL_BITS) */
+    FRAME_BANK, /* value: raw led bank, shown without blanking so that unchanged lines never toggle */
+    FRAME_COUNT, /* value: repeat count of the following frame, shown as blinking nibble */
+    FRAME_NIBBLE, /* value: single BCD digit or hex nibble */
+    FRAME_SEPARATOR, /* value: unused, short flash of all leds between nibble groups */
+    FRAME_SIGN, /* value: bit 0 - result is negative, bit 1 - result overflowed */
+    FRAME_ZERO, /* value: unused, nibble or index 0 as fast blinking of all leds instead of dark frame */
+    LAST_FRAME_KIND
+} frame_kind_t;
+
+typedef struct DisplayFrame {
+    frame_kind_t kind;
+    uint64_t value;
+} display_frame_t;
+
+typedef struct DisplaySchedule {
+    display_frame_t frames[DISPLAY_MAX_FRAMES];
+    size_t num_frames;
+    /* number of result bits carried by the frames */
+    size_t num_bits;
+} display_schedule_t;
+
+typedef enum EntryMode {
+    ENTRY_MODE_BINARY = 0,
+    ENTRY_MODE_DECIMAL,
+    LAST_ENTRY_MODE
+} entry_mode_t;
 
 /* returns next state for poll function */
 typedef bool (*button_callback_t)(void);
 
 typedef struct IoState {
+    gpio_backend_t backend;
+    gpio_backend_t led_backend;
+
+    /* c-periphery backend */
     gpio_t *buttons[NUM_BUTTONS];
     gpio_t *leds[NUM_LEDS];
 
+    /* cdev backend - all buttons and all leds are served by single line request each */
+    gpio_cdev_lines_t cdev_buttons;
+    gpio_cdev_lines_t cdev_leds;
+    gpio_cdev_event_t cdev_events[GPIO_CDEV_EVENT_BATCH];
+    size_t cdev_events_head;
+    size_t cdev_events_count;
+    uint32_t cdev_last_seqno;
+
+    /* mmap backend - set/clear register masks precomputed for every possible bank state */
+    gpio_mmap_regs_t mmap_regs;
+    uint32_t mmap_bank_masks[1 << NUM_LEDS];
+
+    /* bit i holds current state of led i */
+    uint64_t led_bits;
+    /* number of single line transitions since start */
+    uint64_t led_toggles;
+
     struct pollfd fds[NUM_BUTTONS];
     button_callback_t callbacks[NUM_BUTTONS];
 
@@ -74,14 +222,202 @@ typedef struct Args {
     uint64_t args[NUM_ARGS];
     size_t cur_arg;
     size_t arg_bit_idx;
+    /* signed modes - args hold magnitude, sign is kept aside */
+    bool negative[NUM_ARGS];
+
+    /* fixed point and float modes - integer mantissa is entered first, then decimal exponent */
+    bool entering_exponent;
+    int64_t mantissa[NUM_ARGS];
+
+    /* decimal entry - first digit of the open window and number of digits already committed to args[cur_arg] */
+    uint8_t pending_digit;
+    bool pending_touched;
+    size_t num_digits;
 } args_t;
 
+typedef struct RpnState {
+    uint64_t stack[RPN_MAX_DEPTH];
+    size_t depth;
+    /* flags raised by any operation since the stack was last displayed */
+    uint32_t flags;
+    /* phase picked by the command callbacks */
+    calculator_phase_t next_phase;
+} rpn_state_t;
+
+typedef struct Macro {
+    uint64_t operands[MACRO_MAX_STEPS];
+    /* operation of step i at bits [i * MACRO_OP_BITS, (i + 1) * MACRO_OP_BITS) */
+    uint32_t ops;
+    size_t num_steps;
+} macro_t;
+
+_Static_assert(LAST_OPERATION <= MACRO_OP_MASK + 1, "Operation must fit its packed field");
+_Static_assert(MACRO_MAX_STEPS * MACRO_OP_BITS <= 32, "All operations must fit single word");
+
+typedef struct MacroState {
+    macro_t macro;
+    /* steps entered while recording are appended to the macro */
+    bool recording;
+    /* running value the steps are applied to */
+    uint64_t value;
+    uint32_t flags;
+    /* phase picked by the command callbacks */
+    calculator_phase_t next_phase;
+} macro_state_t;
+
+/*
+ * Idle policy - poll waits with timeout only while leds are lit. After the timeout they are blanked
+ * by single bank write and poll blocks without any timeout, so nothing wakes the process until an edge.
+ */
+typedef struct IdleState {
+    bool blanked;
+    /* led bank restored by the first edge after blanking */
+    uint64_t saved_bank;
+    struct timespec blanked_time;
+    /* every return from poll, the only place the main thread wakes up while waiting for buttons */
+    uint64_t num_wakeups;
+    uint64_t blanked_wakeups;
+} idle_state_t;
+
+/*
+ * Running results of first operand and second operand entered so far. Every entry step changes
+ * the operand by known amount, results follow by the same delta instead of being recomputed.
+ */
+typedef struct PreviewState {
+    /* encoded second operand the results correspond to */
+    uint64_t operand;
+    /* addition, subtraction and multiplication, division has no cheap update */
+    uint64_t results[MULTIPLICATION + 1];
+    /* leds show previewed nibble until the next entry button */
+    bool showing;
+    /* regular entry callbacks wrapped by the preview ones */
+    button_callback_t entry_callbacks[NUM_BUTTONS];
+} preview_state_t;
+
+/* every result of the entered operands, computed while the operation is being picked */
+typedef struct Speculation {
+    bool valid;
+    uint64_t args[NUM_ARGS];
+    calc_result_t results[LAST_OPERATION];
+    /* built only when results are played back, browsing needs the value alone */
+    bool has_schedules;
+    display_schedule_t schedules[LAST_OPERATION];
+} speculation_t;
+
+/* calculator state outliving the process, phase is the one running or the next one to run */
+typedef struct CalculatorState {
+    calculator_phase_t phase;
+    args_t args;
+    operation_t operation;
+    uint64_t result;
+    uint32_t result_flags;
+    uint64_t last_displayed;
+    size_t browse_nibble_idx;
+    rpn_state_t rpn;
+    macro_state_t macro;
+
+    /* state is meaningful only for the same number and entry modes */
+    number_mode_t number_mode;
+    unsigned frac_bits;
+    uint64_t modulus;
+    entry_mode_t entry_mode;
+    size_t rpn_depth;
+    bool macro_mode;
+} calculator_state_t;
+
+/*
+ * Calculator state passed to the successor binary together with both line request fds.
+ * Whatever the running phase has entered so far survives, including edges read but not served yet.
+ */
+typedef struct HandoffState {
+    calculator_state_t calculator;
+
+    uint64_t led_bits;
+    bool blanked;
+    uint64_t saved_bank;
+
+    gpio_cdev_event_t events[GPIO_CDEV_EVENT_BATCH];
+    size_t num_events;
+    uint32_t last_seqno;
+    struct timespec last_press_time[NUM_BUTTONS];
+    gpio_edge_t last_press_edge[NUM_BUTTONS];
+
+    /* CLOCK_MONOTONIC right before sending, successor reports the downtime */
+    struct timespec sent_time;
+} handoff_state_t;
+
+typedef struct AppConfig {
+    /* when set, failure of requested backend is fatal instead of falling back to c-periphery */
+    bool force_backend;
+    /* register block used for leds, NULL when leds go through the button backend */
+    const char *gpiomem_path;
+    display_mode_t display_mode;
+    entry_mode_t entry_mode;
+    /* interpretation of operand and result bits */
+    calc_mode_t calc_mode;
+    frame_encoding_t frame_encoding;
+    unsigned pwm_levels;
+    size_t bench_gpio_iterations;
+    /* result is browsed nibble by nibble instead of sequential playback */
+    bool browse_result;
+    /* non-interactive calculation of text records, "-" means stdin/stdout */
+    const char *batch_path;
+    const char *batch_output_path;
+    bool batch_use_mmap;
+    bool bench_batch;
+    /* expression evaluated over batch rows instead of "a op b" lines */
+    const char *batch_expr;
+    expr_syntax_t batch_expr_syntax;
+    size_t batch_threads;
+    batch_format_t batch_output_format;
+    unsigned batch_radix;
+    /* text batch is converted into columnar jobs file instead of being evaluated */
+    const char *batch_convert_path;
+    /* operand stack capacity, 0 disables rpn mode */
+    size_t rpn_depth;
+    /* first operand is followed by macro command phase */
+    bool macro_mode;
+    /* operation previewed during second operand entry, LAST_OPERATION disables preview */
+    operation_t preview_op;
+    /* 0 keeps leds lit forever */
+    int idle_timeout_ms;
+    /* gpio chips of panels served by sharded loops instead of the calculator, empty runs the calculator */
+    const char *panel_paths[PANELS_MAX_PANELS];
+    size_t num_panels;
+    size_t num_shards;
+    /* unix socket the next binary takes lines and state over through */
+    const char *handoff_path;
+    /* state file calculator resumes from after crash */
+    const char *snapshot_path;
+} app_config_t;
+
 typedef struct AppState {
     calculator_phase_t phase;
     bool should_run;
+    app_config_t config;
     io_state_t io;
     args_t args;
     operation_t operation;
+    uint64_t result;
+    uint32_t result_flags;
+    /* raw bits of the result played back last, delta display shows only nibbles differing from it */
+    uint64_t last_displayed;
+    size_t browse_nibble_idx;
+    display_schedule_t schedule;
+    pwm_engine_t pwm;
+    rpn_state_t rpn;
+    macro_state_t macro;
+    preview_state_t preview;
+    idle_state_t idle;
+    /* constants of --modulus, referenced by config.calc_mode */
+    mod_context_t mod;
+    speculation_t speculation;
+    /* listening handoff socket, polled next to the buttons, -1 when disabled */
+    int handoff_fd;
+    /* phase restarted after takeover keeps entered state and leds as they are */
+    bool resuming;
+    /* mapped state file, base is NULL without --snapshot */
+    snapshot_t snapshot;
 } app_state_t;
 
 // ------------------------------
@@ -102,9 +438,29 @@ typedef struct AppState {
 static app_state_t app_state = {
     .phase = ARG_INPUT_FIRST,
     .should_run = true,
-    .io = {},
+    .config = {
+        .display_mode = DISPLAY_MODE_BINARY,
+        .entry_mode = ENTRY_MODE_BINARY,
+        .calc_mode = {
+            .number_mode = NUMBER_MODE_UNSIGNED,
+            .frac_bits = CALC_DEFAULT_FRAC_BITS,
+        },
+        .frame_encoding = FRAME_ENCODING_PLAIN,
+        .pwm_levels = PWM_DEFAULT_LEVELS,
+        .batch_output_path = BATCH_STDIO_PATH,
+        .batch_use_mmap = true,
+        .batch_radix = 10,
+        .preview_op = LAST_OPERATION,
+    },
+    .io = {
+        .backend = GPIO_BACKEND_CDEV,
+        .cdev_buttons = {.fd = -1},
+        .cdev_leds = {.fd = -1},
+        .mmap_regs = {.fd = -1},
+    },
     .args = {},
     .operation = ADDITION,
+    .handoff_fd = -1,
 };
 
 // ------------------------------
@@ -115,6 +471,14 @@ static void InitializeButtons();
 
 static void InitializeLeds();
 
+static bool InitializeCdevButtons();
+
+static bool InitializeCdevLeds();
+
+static bool InitializePeripheryLeds();
+
+static bool InitializeMmapLeds();
+
 static void CleanupButtons();
 
 static void CleanupLeds();
@@ -129,13 +493,45 @@ static calculator_phase_t ProcessOpInputState();
 
 static calculator_phase_t ProcessDisplayInputState();
 
+static calculator_phase_t ProcessBrowseState();
+
+static calculator_phase_t ProcessRpnCommandState();
+
+static calculator_phase_t ProcessMacroCommandState();
+
 static void PollButtons();
 
+static bool PollPeripheryButtons();
+
+static bool PollCdevButtons();
+
+static void EnterIdle();
+
+static void LeaveIdle();
+
+static void SaveCalculatorState(calculator_state_t *state);
+
+static bool IsCompatibleState(const calculator_state_t *state);
+
+static void RestoreCalculatorState(const calculator_state_t *state);
+
+static void InitializeSnapshot(bool restore);
+
+static void StoreSnapshot();
+
+static bool TakeOver();
+
+static void StartHandoff();
+
+static void ServeHandoff();
+
 static void SetLedState(size_t led_num, int state);
 
-static void DisableLed(size_t led_num);
+static void SetLedBank(uint64_t bits);
 
-static void EnableLed(size_t led_num);
+static uint64_t GetLedBank();
+
+static uint64_t NibbleToLedBank(uint64_t nibble);
 
 static bool ArgInputButton0Callback();
 
@@ -145,11 +541,123 @@ static bool ArgInputButton2Callback();
 
 static bool ArgInputButton3Callback();
 
+static bool DecInputButton0Callback();
+
+static bool DecInputButton1Callback();
+
+static bool DecInputButton2Callback();
+
+static bool DecInputButton3Callback();
+
+static bool CommitPendingDigit();
+
+static bool CommitWindowDigit(uint8_t offset);
+
+static void TraceArgument(uint64_t value);
+
+static void ResetArgEntry();
+
+static bool FinishArgEntry();
+
+static void PreviewStart();
+
+static void PreviewUpdate();
+
+static bool PreviewButton0Callback();
+
+static bool PreviewButton1Callback();
+
+static bool PreviewButton2Callback();
+
+static bool PreviewButton3Callback();
+
+static void DisplayPendingDigit();
+
 static bool OpInputButton0Callback();
 
 static bool OpInputButton1Callback();
 
-static uint64_t Calculate();
+static bool BrowseButton0Callback();
+
+static bool BrowseButton1Callback();
+
+static bool BrowseButton2Callback();
+
+static bool BrowseButton3Callback();
+
+static void DisplayBrowsedNibble();
+
+static bool RpnButton0Callback();
+
+static bool RpnButton1Callback();
+
+static bool RpnButton2Callback();
+
+static bool RpnButton3Callback();
+
+static bool RpnPush(uint64_t value);
+
+static calc_result_t RpnPopResult();
+
+static bool MacroButton0Callback();
+
+static bool MacroButton1Callback();
+
+static bool MacroButton2Callback();
+
+static bool MacroButton3Callback();
+
+static bool MacroAppendStep(macro_t *macro, operation_t op, uint64_t operand);
+
+static operation_t MacroStepOperation(const macro_t *macro, size_t step);
+
+static calc_result_t MacroReplay(const macro_t *macro, uint64_t value);
+
+static calc_result_t Calculate(operation_t op, uint64_t a, uint64_t b);
+
+static void Speculate(uint64_t a, uint64_t b);
+
+static bool IsSpeculated(uint64_t a, uint64_t b);
+
+static uint64_t EncodedArg(size_t arg_num);
+
+static int64_t SignedArg(size_t arg_num);
+
+static void ToggleArgSign();
+
+static void BuildDisplaySchedule(display_schedule_t *schedule, calc_result_t result);
+
+static void BuildBinarySchedule(display_schedule_t *schedule, uint64_t result);
+
+static void BuildPwmSchedule(display_schedule_t *schedule, uint64_t result, unsigned levels);
+
+static void BuildRleSchedule(display_schedule_t *schedule, uint64_t result);
+
+static void BuildDecimalSchedule(display_schedule_t *schedule, uint64_t result);
+
+static void BuildDeltaSchedule(display_schedule_t *schedule, calc_result_t calc_result, uint64_t previous);
+
+static void BuildFixedSchedule(display_schedule_t *schedule, calc_result_t result, unsigned frac_bits);
+
+static void BuildFloatSchedule(display_schedule_t *schedule, calc_result_t result);
+
+static void PushNibbles(display_schedule_t *schedule, uint64_t value, size_t num_nibbles);
+
+static void PushFrame(display_schedule_t *schedule, frame_kind_t kind, uint64_t value);
+
+static uint64_t FrameDurationMs(frame_kind_t kind);
+
+static uint64_t ScheduleDurationMs(const display_schedule_t *schedule);
+
+static void EncodeMinToggleSchedule(display_schedule_t *schedule);
+
+static uint64_t GrayCode(uint64_t value);
+
+static void PresentSchedule(const display_schedule_t *schedule);
+
+static void PresentFrame(const display_frame_t *frame);
+
+static void PwmWriteLedBank(uint64_t bits, void *ctx);
 
 static void ShineLeds();
 
@@ -163,9 +671,19 @@ static void EnableAllLeds();
 
 static void DisplayLast4Bits();
 
+static size_t ArgMaxBits();
+
 static void DisplayOperation();
 
-static bool ShouldTrigger(size_t button_idx, gpio_edge_t edge);
+static bool ShouldTrigger(size_t button_idx, gpio_edge_t edge, struct timespec current_time);
+
+static bool ParseArguments(int argc, char *argv[]);
+
+static bool ParseNumberArgument(const char *name, const char *text, uint64_t *value);
+
+static void PrintUsage(const char *program);
+
+static void BenchmarkGpioBackends(size_t iterations);
 
 // ------------------------------
 // Test functions
@@ -196,6 +714,20 @@ void InitializeButtons() {
         app_state.io.last_press_time[i].tv_nsec = 0;
     }
 
+    if (app_state.io.backend == GPIO_BACKEND_CDEV) {
+        if (InitializeCdevButtons()) {
+            TRACE("Correctly initialized buttons!\n");
+            return;
+        }
+
+        if (app_state.config.force_backend) {
+            exit(EXIT_FAILURE);
+        }
+
+        TRACE("Falling back to c-periphery backend\n");
+        app_state.io.backend = GPIO_BACKEND_PERIPHERY;
+    }
+
     for (size_t i = 0; i < NUM_BUTTONS; i++) {
         app_state.io.buttons[i] = gpio_new();
 
@@ -206,6 +738,7 @@ void InitializeButtons() {
             for (int j = 0; j < i; j++) {
                 gpio_close(app_state.io.buttons[j]);
                 gpio_free(app_state.io.buttons[j]);
+                app_state.io.buttons[j] = NULL;
             }
 
             exit(EXIT_FAILURE);
@@ -231,33 +764,150 @@ void InitializeButtons() {
 void InitializeLeds() {
     TRACE("Initializing leds...\n");
 
+    app_state.io.led_backend = app_state.config.gpiomem_path != NULL ? GPIO_BACKEND_MMAP : app_state.io.backend;
+
+    bool initialized = false;
+    switch (app_state.io.led_backend) {
+        case GPIO_BACKEND_CDEV:
+            initialized = InitializeCdevLeds();
+            break;
+        case GPIO_BACKEND_PERIPHERY:
+            initialized = InitializePeripheryLeds();
+            break;
+        case GPIO_BACKEND_MMAP:
+            initialized = InitializeMmapLeds();
+            break;
+        case LAST_GPIO_BACKEND:
+            break;
+    }
+
+    if (!initialized) {
+        CleanupButtons();
+        exit(EXIT_FAILURE);
+    }
+
+    TRACE("Leds initialized!\n");
+}
+
+bool InitializePeripheryLeds() {
     for (size_t i = 0; i < NUM_LEDS; i++) {
         app_state.io.leds[i] = gpio_new();
 
         if (gpio_open(app_state.io.leds[i], GPIO_SYS_PATH, kLedPins[i], GPIO_DIR_OUT) < 0) {
             TRACE("Error initializing LED on pin %d: %s\n", kLedPins[i], gpio_errmsg(app_state.io.leds[i]));
 
-            CleanupButtons();
-
             for (size_t j = 0; j < i; j++) {
                 gpio_close(app_state.io.leds[j]);
                 gpio_free(app_state.io.leds[j]);
+                app_state.io.leds[j] = NULL;
             }
 
-            exit(EXIT_FAILURE);
+            return false;
         }
     }
 
+    /* state of lines is unknown, so force the first write */
+    app_state.io.led_bits = ALL_LEDS_MASK;
     DisableAllLeds();
 
-    TRACE("Leds initialized!\n");
+    return true;
+}
+
+bool InitializeCdevButtons() {
+    const int chip_fd = GpioCdevOpenChip(GPIO_SYS_PATH);
+    if (chip_fd < 0) {
+        TRACE("Failed to open %s: %s!\n", GPIO_SYS_PATH, strerror(errno));
+        return false;
+    }
+
+    /* line request fd stays valid after chip is closed */
+    const int ret = GpioCdevRequestInputs(&app_state.io.cdev_buttons, chip_fd, kButtonPins, NUM_BUTTONS,
+                                          KERNEL_DEBOUNCE_US);
+    GpioCdevCloseChip(chip_fd);
+
+    if (ret < 0) {
+        TRACE("Failed to request buttons through cdev v2: %s!\n", strerror(errno));
+        return false;
+    }
+
+    app_state.io.cdev_events_head = 0;
+    app_state.io.cdev_events_count = 0;
+    app_state.io.cdev_last_seqno = 0;
+
+    app_state.io.fds[0].fd = app_state.io.cdev_buttons.fd;
+    app_state.io.fds[0].events = POLLIN | POLLPRI;
+
+    return true;
+}
+
+bool InitializeCdevLeds() {
+    const int chip_fd = GpioCdevOpenChip(GPIO_SYS_PATH);
+    if (chip_fd < 0) {
+        TRACE("Failed to open %s: %s!\n", GPIO_SYS_PATH, strerror(errno));
+        return false;
+    }
+
+    /* leds are requested already disabled */
+    const int ret = GpioCdevRequestOutputs(&app_state.io.cdev_leds, chip_fd, kLedPins, NUM_LEDS, 0);
+    GpioCdevCloseChip(chip_fd);
+
+    if (ret < 0) {
+        TRACE("Failed to request leds through cdev v2: %s!\n", strerror(errno));
+        return false;
+    }
+
+    app_state.io.led_bits = 0;
+
+    return true;
+}
+
+bool InitializeMmapLeds() {
+    if (GpioMmapOpen(&app_state.io.mmap_regs, app_state.config.gpiomem_path) < 0) {
+        TRACE("Failed to map GPIO registers from %s: %s!\n", app_state.config.gpiomem_path, strerror(errno));
+        return false;
+    }
+
+    uint32_t pin_masks[NUM_LEDS];
+    for (size_t i = 0; i < NUM_LEDS; i++) {
+        if (GpioMmapSetOutput(&app_state.io.mmap_regs, kLedPins[i]) < 0) {
+            TRACE("LED pin %d can't be driven through registers!\n", kLedPins[i]);
+            GpioMmapClose(&app_state.io.mmap_regs);
+            return false;
+        }
+
+        pin_masks[i] = (uint32_t) 1 << kLedPins[i];
+    }
+
+    app_state.io.led_bits = ALL_LEDS_MASK;
+
+    for (size_t bits = 0; bits < (1 << NUM_LEDS); bits++) {
+        app_state.io.mmap_bank_masks[bits] = 0;
+
+        for (size_t i = 0; i < NUM_LEDS; i++) {
+            if (bits & ((size_t) 1 << i)) {
+                app_state.io.mmap_bank_masks[bits] |= pin_masks[i];
+            }
+        }
+    }
+
+    DisableAllLeds();
+
+    return true;
 }
 
 void CleanupButtons() {
     TRACE("Cleaning up buttons...\n");
+
+    GpioCdevRelease(&app_state.io.cdev_buttons);
+
     for (size_t i = 0; i < NUM_BUTTONS; i++) {
+        if (app_state.io.buttons[i] == NULL) {
+            continue;
+        }
+
         gpio_close(app_state.io.buttons[i]);
         gpio_free(app_state.io.buttons[i]);
+        app_state.io.buttons[i] = NULL;
     }
     TRACE("Buttons closed!\n");
 }
@@ -265,9 +915,17 @@ void CleanupButtons() {
 void CleanupLeds() {
     TRACE("Cleaning up leds...\n");
 
+    GpioCdevRelease(&app_state.io.cdev_leds);
+    GpioMmapClose(&app_state.io.mmap_regs);
+
     for (size_t i = 0; i < NUM_LEDS; i++) {
+        if (app_state.io.leds[i] == NULL) {
+            continue;
+        }
+
         gpio_close(app_state.io.leds[i]);
         gpio_free(app_state.io.leds[i]);
+        app_state.io.leds[i] = NULL;
     }
 
     TRACE("Leds closed!\n");
@@ -276,6 +934,10 @@ void CleanupLeds() {
 void CleanUp() {
     CleanupButtons();
     CleanupLeds();
+
+    if (app_state.snapshot.base != NULL) {
+        SnapshotClose(&app_state.snapshot);
+    }
 }
 
 static void RunStateMachine() {
@@ -297,41 +959,99 @@ static void RunStateMachine() {
                 TRACE("Entering ARG_DISPLAY state\n");
                 app_state.phase = ProcessDisplayInputState();
                 break;
+            case RESULT_BROWSE:
+                TRACE("Entering RESULT_BROWSE state\n");
+                app_state.phase = ProcessBrowseState();
+                break;
+            case RPN_COMMAND:
+                TRACE("Entering RPN_COMMAND state\n");
+                app_state.phase = ProcessRpnCommandState();
+                break;
+            case MACRO_COMMAND:
+                TRACE("Entering MACRO_COMMAND state\n");
+                app_state.phase = ProcessMacroCommandState();
+                break;
             case LAST_PHASE:
                 TRACE("Reached last phase. Restarting calculation!\n");
                 app_state.phase = ARG_INPUT_FIRST;
                 break;
         }
+
+        app_state.resuming = false;
+        StoreSnapshot();
     }
 }
 
 calculator_phase_t ProcessArgInputState(const int arg_num) {
-    app_state.args.cur_arg = (size_t) arg_num;
-    app_state.args.arg_bit_idx = 0;
-    app_state.args.args[arg_num] = 0;
-    DisableAllLeds();
+    app_state.speculation.valid = false;
+
+    if (!app_state.resuming) {
+        app_state.args.cur_arg = (size_t) arg_num;
+        app_state.args.entering_exponent = false;
+        ResetArgEntry();
+    }
 
-    app_state.io.callbacks[0] = ArgInputButton0Callback;
-    app_state.io.callbacks[1] = ArgInputButton1Callback;
-    app_state.io.callbacks[2] = ArgInputButton2Callback;
-    app_state.io.callbacks[3] = ArgInputButton3Callback;
+    if (app_state.config.entry_mode == ENTRY_MODE_DECIMAL) {
+        app_state.io.callbacks[0] = DecInputButton0Callback;
+        app_state.io.callbacks[1] = DecInputButton1Callback;
+        app_state.io.callbacks[2] = DecInputButton2Callback;
+        app_state.io.callbacks[3] = DecInputButton3Callback;
+
+        if (arg_num == 0) {
+            TRACE("Leds show first digit of the open window, 0 as all lit\n"
+                "Button 1: commit first digit of the window, proceed to next phase when no window is open\n"
+                "Button 2: open window at 0, or move open window by 3\n"
+                "Button 3: open window at 5, or commit second digit of the window\n"
+                "Button 4: commit third digit of the window, or remove last committed digit%s\n%s",
+                CalcIsSignedMode(app_state.config.calc_mode) ? " (toggles sign when empty)" : "",
+                CalcIsRealMode(app_state.config.calc_mode)
+                    ? "Mantissa is entered first, button 1 then proceeds to decimal exponent\n"
+                    : "");
+        }
+    } else {
+        app_state.io.callbacks[0] = ArgInputButton0Callback;
+        app_state.io.callbacks[1] = ArgInputButton1Callback;
+        app_state.io.callbacks[2] = ArgInputButton2Callback;
+        app_state.io.callbacks[3] = ArgInputButton3Callback;
+
+        /* dispolay help for first button */
+        if (arg_num == 0) {
+            TRACE("Button 1: proceed to next phase\n"
+                "Button 2: add 0 bit\n"
+                "Button 3: add 1 bit\n"
+                "Button 4: remove last added bit%s\n%s",
+                CalcIsSignedMode(app_state.config.calc_mode) ? " (toggles sign when empty)" : "",
+                CalcIsRealMode(app_state.config.calc_mode)
+                    ? "Mantissa is entered first, button 1 then proceeds to decimal exponent\n"
+                    : "");
+        }
+    }
 
-    /* dispolay help for first button */
-    if (arg_num == 0) {
-        TRACE("Button 1: proceed to next phase\n"
-            "Button 2: add 0 bit\n"
-            "Button 3: add 1 bit\n"
-            "Button 4: remove last added bit\n");
+    if (arg_num == 1 && app_state.config.preview_op != LAST_OPERATION) {
+        PreviewStart();
     }
 
     PollButtons();
 
+    if (app_state.config.rpn_depth > 0) {
+        RpnPush(EncodedArg(0));
+        return RPN_COMMAND;
+    }
+
+    if (app_state.config.macro_mode && arg_num == 0) {
+        app_state.macro.value = EncodedArg(0);
+        app_state.macro.flags = 0;
+        return MACRO_COMMAND;
+    }
+
     return arg_num == 0 ? ARG_INPUT_SECOND : ARG_INPUT_OPERATION;
 }
 
 calculator_phase_t ProcessOpInputState() {
-    app_state.operation = ADDITION;
-    DisableAllLeds();
+    if (!app_state.resuming) {
+        app_state.operation = ADDITION;
+        DisableAllLeds();
+    }
 
     app_state.io.callbacks[0] = OpInputButton0Callback;
     app_state.io.callbacks[1] = OpInputButton1Callback;
@@ -345,53 +1065,151 @@ calculator_phase_t ProcessOpInputState() {
         "0 - addition\n"
         "1 - subtraction\n"
         "2 - multiplication\n"
-        "3 - division\n");
+        "3 - division (exponentiation in modular mode)\n");
+
+    /* both operands are final, so all outcomes are ready before the operator settles on one */
+    if (app_state.config.rpn_depth == 0 && !app_state.config.macro_mode) {
+        Speculate(EncodedArg(0), EncodedArg(1));
+    }
 
     PollButtons();
 
+    /* recorded step is applied right away, running value is shown only when recording ends */
+    if (app_state.macro.recording) {
+        const uint64_t operand = EncodedArg(1);
+        const calc_result_t result = Calculate(app_state.operation, app_state.macro.value, operand);
+
+        MacroAppendStep(&app_state.macro.macro, app_state.operation, operand);
+        app_state.macro.value = result.value;
+        app_state.macro.flags |= result.flags;
+
+        return MACRO_COMMAND;
+    }
+
     return ARG_DISPLAY;
 }
 
 calculator_phase_t ProcessDisplayInputState() {
-    const uint64_t result = Calculate();
-    TRACE("Result: %lu\n", result);
-
-    ShineLeds();
-
-    if (result == 0) {
-        Signal0Bit();
-        CHECKED_RUN(usleep(PRESENTATION_BLANK_LEDS_MS * 1000));
+    calc_result_t result;
+    bool precomputed = false;
+
+    if (app_state.config.rpn_depth > 0) {
+        result = RpnPopResult();
+    } else if (app_state.config.macro_mode) {
+        result.value = app_state.macro.value;
+        result.flags = app_state.macro.flags;
     } else {
-        int msb = 63;
-        while (msb >= 0 && !(result & ((uint64_t) 1 << msb))) {
-            msb--;
-        }
+        result = Calculate(app_state.operation, EncodedArg(0), EncodedArg(1));
+        precomputed = IsSpeculated(EncodedArg(0), EncodedArg(1)) && app_state.speculation.has_schedules;
+    }
 
-        for (int cur = msb; cur >= 0; cur--) {
-            const uint64_t bit = result & ((uint64_t) 1 << cur);
+    char text[CALC_MAX_FORMATTED_LEN];
+    CalcFormatValue(app_state.config.calc_mode, result.value, text);
+    TRACE("Result: %s\n", text);
 
-            if (bit) {
-                Signal1Bit();
-            } else {
-                Signal0Bit();
-            }
+    app_state.result = result.value;
+    app_state.result_flags = result.flags;
 
-            CHECKED_RUN(usleep(PRESENTATION_BLANK_LEDS_MS * 1000));
-        }
+    if (app_state.config.browse_result) {
+        ShineLeds();
+        return RESULT_BROWSE;
+    }
+
+    if (precomputed) {
+        app_state.schedule = app_state.speculation.schedules[app_state.operation];
+    } else {
+        BuildDisplaySchedule(&app_state.schedule, result);
     }
 
+    TRACE("Result takes %lu frames, %lu ms\n", app_state.schedule.num_frames,
+          ScheduleDurationMs(&app_state.schedule));
+
+    ShineLeds();
+    PresentSchedule(&app_state.schedule);
     ShineLeds();
 
+    app_state.last_displayed = result.value;
+
     return LAST_PHASE;
 }
 
-bool ShouldTrigger(size_t button_idx, gpio_edge_t edge) {
-    struct timespec current_time;
-    if (clock_gettime(CLOCK_MONOTONIC, &current_time) < 0) {
-        TRACE("Error getting current time for debounce\n");
-        return false;
+calculator_phase_t ProcessBrowseState() {
+    /* start from the most significant nibble holding any set bit, as sequential playback does */
+    if (!app_state.resuming) {
+        app_state.browse_nibble_idx = app_state.result == 0
+                                          ? 0
+                                          : (size_t) (63 - __builtin_clzll(app_state.result)) / NIBBLE_BITS;
     }
 
+    app_state.io.callbacks[0] = BrowseButton0Callback;
+    app_state.io.callbacks[1] = BrowseButton1Callback;
+    app_state.io.callbacks[2] = BrowseButton2Callback;
+    app_state.io.callbacks[3] = BrowseButton3Callback;
+
+    /* display help */
+    TRACE("Button 1: finish browsing\n"
+        "Button 2: next (less significant) nibble\n"
+        "Button 3: previous (more significant) nibble\n"
+        "Button 4: blink index of shown nibble (0 - least significant, dark leds mean 0)\n");
+
+    DisplayBrowsedNibble();
+    PollButtons();
+    DisableAllLeds();
+
+    return LAST_PHASE;
+}
+
+calculator_phase_t ProcessRpnCommandState() {
+    app_state.rpn.next_phase = ARG_DISPLAY;
+
+    app_state.io.callbacks[0] = RpnButton0Callback;
+    app_state.io.callbacks[1] = RpnButton1Callback;
+    app_state.io.callbacks[2] = RpnButton2Callback;
+    app_state.io.callbacks[3] = RpnButton3Callback;
+
+    /* display help */
+    TRACE("Stack depth: %lu/%lu\n"
+        "Button 1: apply shown operation to two topmost operands\n"
+        "Button 2: pick next operation\n"
+        "Button 3: enter next operand\n"
+        "Button 4: display topmost operand and clear the stack\n",
+        app_state.rpn.depth, app_state.config.rpn_depth);
+
+    DisplayOperation();
+    PollButtons();
+    DisableAllLeds();
+
+    return app_state.rpn.next_phase;
+}
+
+calculator_phase_t ProcessMacroCommandState() {
+    app_state.macro.next_phase = ARG_DISPLAY;
+
+    app_state.io.callbacks[0] = MacroButton0Callback;
+    app_state.io.callbacks[1] = MacroButton1Callback;
+    app_state.io.callbacks[2] = MacroButton2Callback;
+    app_state.io.callbacks[3] = MacroButton3Callback;
+
+    /* display help */
+    TRACE("Macro: %lu steps%s\n"
+        "Button 1: %s and display the result\n"
+        "Button 2: %s\n"
+        "Button 3: display value as is%s\n"
+        "Button 4: clear macro\n",
+        app_state.macro.macro.num_steps, app_state.macro.recording ? " (recording)" : "",
+        app_state.macro.recording ? "finish recording" : "replay macro",
+        app_state.macro.recording ? "record next step" : "record new macro, starting with its first step",
+        app_state.macro.recording ? " and drop recording" : "");
+
+    /* leds show number of recorded steps */
+    SetLedBank(NibbleToLedBank(app_state.macro.macro.num_steps & ALL_LEDS_MASK));
+    PollButtons();
+    DisableAllLeds();
+
+    return app_state.macro.next_phase;
+}
+
+bool ShouldTrigger(size_t button_idx, gpio_edge_t edge, struct timespec current_time) {
     struct timespec *last_press = &app_state.io.last_press_time[button_idx];
 
     long diff_ms = (current_time.tv_sec - last_press->tv_sec) * 1000 +
@@ -420,8 +1238,22 @@ bool ShouldTrigger(size_t button_idx, gpio_edge_t edge) {
 void PollButtons() {
     bool should_poll = true;
 
+    /* events left over from previous phase are served first */
+    if (app_state.io.backend == GPIO_BACKEND_CDEV && app_state.io.cdev_events_count > 0) {
+        should_poll = PollCdevButtons();
+        StoreSnapshot();
+    }
+
     while (should_poll) {
-        int ret = poll(app_state.io.fds, NUM_BUTTONS, -1);
+        /* handoff socket takes slot right after single cdev request */
+        const nfds_t num_fds = app_state.io.backend == GPIO_BACKEND_CDEV ? (app_state.handoff_fd >= 0 ? 2 : 1)
+                                                                          : NUM_BUTTONS;
+        const int timeout_ms = app_state.config.idle_timeout_ms > 0 && !app_state.idle.blanked
+                                   ? app_state.config.idle_timeout_ms
+                                   : -1;
+        int ret = poll(app_state.io.fds, num_fds, timeout_ms);
+
+        app_state.idle.num_wakeups++;
 
         if (ret < 0) {
             TRACE("Polling failed!\n");
@@ -429,123 +1261,1575 @@ void PollButtons() {
             exit(EXIT_FAILURE);
         }
 
-        for (size_t i = 0; i < NUM_BUTTONS; i++) {
-            if (app_state.io.fds[i].revents & (POLLIN | POLLPRI)) {
-                gpio_edge_t event;
-                if (gpio_read_event(app_state.io.buttons[i], &event, NULL) < 0) {
-                    TRACE("Error reading event from button_%lu: %s\n", i, gpio_errmsg(app_state.io.buttons[i]));
+        if (ret == 0) {
+            EnterIdle();
+            continue;
+        }
 
-                    CleanUp();
-                    exit(EXIT_FAILURE);
-                }
+        if (num_fds == 2 && (app_state.io.fds[1].revents & POLLIN)) {
+            ServeHandoff();
 
-                if (ShouldTrigger(i, event) && app_state.io.callbacks[i] != NULL) {
-                    should_poll = app_state.io.callbacks[i]();
-                }
+            if ((app_state.io.fds[0].revents & (POLLIN | POLLPRI)) == 0) {
+                continue;
             }
         }
-    }
-}
 
-void SetLedState(const size_t led_num, const int state) {
-    if (gpio_write(app_state.io.leds[led_num], state) < 0) {
-        TRACE("Error enabling LED: %s\n", gpio_errmsg(app_state.io.leds[led_num]));
+        if (app_state.idle.blanked) {
+            LeaveIdle();
+        }
 
-        CleanUp();
-        exit(EXIT_FAILURE);
+        should_poll = app_state.io.backend == GPIO_BACKEND_CDEV ? PollCdevButtons() : PollPeripheryButtons();
+        /* every served edge may have changed the state */
+        StoreSnapshot();
     }
 }
 
-void DisableLed(const size_t led_num) {
-    SetLedState(led_num, 0);
+void EnterIdle() {
+    idle_state_t *idle = &app_state.idle;
+
+    idle->saved_bank = app_state.io.led_bits;
+    idle->blanked = true;
+    idle->blanked_wakeups = idle->num_wakeups;
+    clock_gettime(CLOCK_MONOTONIC, &idle->blanked_time);
+
+    /* single write, pwm thread only runs during playback, so no timer is left behind */
+    SetLedBank(0);
+    TRACE("Idle, leds blanked until next button\n");
+}
+
+void LeaveIdle() {
+    idle_state_t *idle = &app_state.idle;
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    /* the wakeup serving this edge is not counted as idle one */
+    const double idle_s = (double) (now.tv_sec - idle->blanked_time.tv_sec) +
+                          (double) (now.tv_nsec - idle->blanked_time.tv_nsec) / 1e9;
+    const uint64_t wakeups = idle->num_wakeups - idle->blanked_wakeups - 1;
+
+    TRACE("Idle for %.1f s, %lu wakeups (%.3f/s), %lu wakeups since start\n", idle_s, wakeups,
+          idle_s > 0 ? (double) wakeups / idle_s : 0.0, idle->num_wakeups);
+
+    idle->blanked = false;
+    SetLedBank(idle->saved_bank);
+}
+
+void SaveCalculatorState(calculator_state_t *state) {
+    /* padding is stored too, keep it deterministic */
+    memset(state, 0, sizeof(*state));
+
+    state->phase = app_state.phase;
+    state->args = app_state.args;
+    state->operation = app_state.operation;
+    state->result = app_state.result;
+    state->result_flags = app_state.result_flags;
+    state->last_displayed = app_state.last_displayed;
+    state->browse_nibble_idx = app_state.browse_nibble_idx;
+    state->rpn = app_state.rpn;
+    state->macro = app_state.macro;
+
+    state->number_mode = app_state.config.calc_mode.number_mode;
+    state->frac_bits = app_state.config.calc_mode.frac_bits;
+    state->modulus = app_state.config.calc_mode.number_mode == NUMBER_MODE_MODULAR
+                         ? app_state.config.calc_mode.mod->modulus
+                         : 0;
+    state->entry_mode = app_state.config.entry_mode;
+    state->rpn_depth = app_state.config.rpn_depth;
+    state->macro_mode = app_state.config.macro_mode;
+}
+
+bool IsCompatibleState(const calculator_state_t *state) {
+    const calc_mode_t mode = app_state.config.calc_mode;
+
+    return state->number_mode == mode.number_mode &&
+           (mode.number_mode != NUMBER_MODE_FIXED || state->frac_bits == mode.frac_bits) &&
+           (mode.number_mode != NUMBER_MODE_MODULAR || state->modulus == mode.mod->modulus) &&
+           state->entry_mode == app_state.config.entry_mode && state->rpn_depth == app_state.config.rpn_depth &&
+           state->macro_mode == app_state.config.macro_mode && state->phase < LAST_PHASE &&
+           state->args.cur_arg < NUM_ARGS && state->rpn.depth <= RPN_MAX_DEPTH &&
+           state->macro.macro.num_steps <= MACRO_MAX_STEPS && state->operation < LAST_OPERATION;
+}
+
+void RestoreCalculatorState(const calculator_state_t *state) {
+    app_state.phase = state->phase;
+    app_state.args = state->args;
+    app_state.operation = state->operation;
+    app_state.result = state->result;
+    app_state.result_flags = state->result_flags;
+    app_state.last_displayed = state->last_displayed;
+    app_state.browse_nibble_idx = state->browse_nibble_idx;
+    app_state.rpn = state->rpn;
+    app_state.macro = state->macro;
+    app_state.resuming = true;
+}
+
+void InitializeSnapshot(const bool restore) {
+    if (SnapshotOpen(&app_state.snapshot, app_state.config.snapshot_path, sizeof(calculator_state_t),
+                     SNAPSHOT_STATE_VERSION) < 0) {
+        TRACE("Failed to open state file %s: %s!\n", app_state.config.snapshot_path, strerror(errno));
+        CleanUp();
+        exit(EXIT_FAILURE);
+    }
+
+    /* state handed over by running process is newer than anything in the file */
+    if (!restore) {
+        return;
+    }
+
+    struct timespec start, end;
+    calculator_state_t state;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (!SnapshotLoad(&app_state.snapshot, &state)) {
+        TRACE("No saved state in %s\n", app_state.config.snapshot_path);
+        return;
+    }
+
+    if (!IsCompatibleState(&state)) {
+        TRACE("Saved state uses other number, entry or command mode, starting over\n");
+        return;
+    }
+
+    RestoreCalculatorState(&state);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    TRACE("Resumed saved state in %.1f us\n",
+          (double) (end.tv_sec - start.tv_sec) * 1e6 + (double) (end.tv_nsec - start.tv_nsec) / 1e3);
+
+    /* lines were requested anew, entry phases show their progress only after next press */
+    switch (app_state.phase) {
+        case ARG_INPUT_FIRST:
+        case ARG_INPUT_SECOND:
+            if (app_state.config.entry_mode == ENTRY_MODE_DECIMAL) {
+                DisplayPendingDigit();
+            } else {
+                DisplayLast4Bits();
+            }
+            break;
+        case ARG_INPUT_OPERATION:
+            DisplayOperation();
+            break;
+        default:
+            break;
+    }
+}
+
+void StoreSnapshot() {
+    if (app_state.snapshot.base == NULL) {
+        return;
+    }
+
+    calculator_state_t state;
+    SaveCalculatorState(&state);
+    SnapshotStore(&app_state.snapshot, &state);
+}
+
+bool TakeOver() {
+    handoff_state_t state;
+    int fds[HANDOFF_NUM_FDS];
+    const int sock = HandoffReceive(app_state.config.handoff_path, fds, HANDOFF_NUM_FDS, &state, sizeof(state),
+                                    HANDOFF_STATE_VERSION);
+
+    if (sock < 0) {
+        if (errno == ENOENT || errno == ECONNREFUSED) {
+            return false;
+        }
+
+        /* predecessor keeps the lines, so they can't be requested here either */
+        TRACE("Handoff from running process failed: %s!\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    const bool compatible = state.num_events <= GPIO_CDEV_EVENT_BATCH && IsCompatibleState(&state.calculator);
+
+    if (!compatible) {
+        TRACE("Running process uses other number, entry or command mode, handoff declined!\n");
+        HandoffFinish(sock, false);
+        close(fds[0]);
+        close(fds[1]);
+        exit(EXIT_FAILURE);
+    }
+
+    /* predecessor decides, lines are ours only after its commit, it stops serving once that is sent */
+    if (HandoffFinish(sock, true) < 0) {
+        TRACE("Running process kept serving, handoff aborted!\n");
+        close(fds[0]);
+        close(fds[1]);
+        exit(EXIT_FAILURE);
+    }
+
+    io_state_t *io = &app_state.io;
+
+    io->backend = GPIO_BACKEND_CDEV;
+    io->led_backend = GPIO_BACKEND_CDEV;
+    io->cdev_buttons.fd = fds[0];
+    io->cdev_buttons.num_lines = NUM_BUTTONS;
+    io->cdev_leds.fd = fds[1];
+    io->cdev_leds.num_lines = NUM_LEDS;
+
+    for (size_t i = 0; i < NUM_BUTTONS; i++) {
+        io->cdev_buttons.offsets[i] = (uint32_t) kButtonPins[i];
+    }
+
+    for (size_t i = 0; i < NUM_LEDS; i++) {
+        io->cdev_leds.offsets[i] = (uint32_t) kLedPins[i];
+    }
+
+    io->fds[0].fd = io->cdev_buttons.fd;
+    io->fds[0].events = POLLIN | POLLPRI;
+
+    /* lines were never touched, bits only have to match them */
+    io->led_bits = state.led_bits;
+    memcpy(io->cdev_events, state.events, state.num_events * sizeof(state.events[0]));
+    io->cdev_events_head = 0;
+    io->cdev_events_count = state.num_events;
+    io->cdev_last_seqno = state.last_seqno;
+    memcpy(io->last_press_time, state.last_press_time, sizeof(io->last_press_time));
+    memcpy(io->last_press_edge, state.last_press_edge, sizeof(io->last_press_edge));
+
+    RestoreCalculatorState(&state.calculator);
+    app_state.idle.blanked = state.blanked;
+    app_state.idle.saved_bank = state.saved_bank;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    app_state.idle.blanked_time = now;
+
+    TRACE("Took over running process in %.1f us, %lu queued events\n",
+          (double) (now.tv_sec - state.sent_time.tv_sec) * 1e6 +
+              (double) (now.tv_nsec - state.sent_time.tv_nsec) / 1e3,
+          state.num_events);
+    return true;
+}
+
+void StartHandoff() {
+    if (app_state.io.backend != GPIO_BACKEND_CDEV || app_state.io.led_backend != GPIO_BACKEND_CDEV) {
+        TRACE("Handoff needs cdev buttons and leds, disabled\n");
+        return;
+    }
+
+    app_state.handoff_fd = HandoffListen(app_state.config.handoff_path);
+
+    if (app_state.handoff_fd < 0) {
+        TRACE("Failed to listen for handoff on %s: %s\n", app_state.config.handoff_path, strerror(errno));
+        return;
+    }
+
+    app_state.io.fds[1].fd = app_state.handoff_fd;
+    app_state.io.fds[1].events = POLLIN;
+    TRACE("Next binary started with --handoff=%s takes over\n", app_state.config.handoff_path);
+}
+
+void ServeHandoff() {
+    const io_state_t *io = &app_state.io;
+    handoff_state_t state;
+
+    /* padding goes over the socket too */
+    memset(&state, 0, sizeof(state));
+
+    SaveCalculatorState(&state.calculator);
+
+    state.led_bits = io->led_bits;
+    state.blanked = app_state.idle.blanked;
+    state.saved_bank = app_state.idle.saved_bank;
+
+    memcpy(state.events, &io->cdev_events[io->cdev_events_head], io->cdev_events_count * sizeof(state.events[0]));
+    state.num_events = io->cdev_events_count;
+    state.last_seqno = io->cdev_last_seqno;
+    memcpy(state.last_press_time, io->last_press_time, sizeof(state.last_press_time));
+    memcpy(state.last_press_edge, io->last_press_edge, sizeof(state.last_press_edge));
+
+    /* kernel keeps queueing edges on the shared request meanwhile, successor reads them */
+    const int fds[HANDOFF_NUM_FDS] = {io->cdev_buttons.fd, io->cdev_leds.fd};
+    clock_gettime(CLOCK_MONOTONIC, &state.sent_time);
+
+    const int ret = HandoffSend(app_state.handoff_fd, fds, HANDOFF_NUM_FDS, &state, sizeof(state),
+                                HANDOFF_STATE_VERSION);
+
+    if (ret <= 0) {
+        TRACE("Handoff %s, still running\n", ret < 0 ? strerror(errno) : "declined or not accepted in time");
+        return;
+    }
+
+    /* successor holds its own references, closing ours releases no line; socket path is its now */
+    TRACE("Handed over to successor, exiting\n");
+    close(app_state.handoff_fd);
+    CleanUp();
+    exit(0);
+}
+
+bool PollPeripheryButtons() {
+    bool should_poll = true;
+
+    for (size_t i = 0; i < NUM_BUTTONS; i++) {
+        if (app_state.io.fds[i].revents & (POLLIN | POLLPRI)) {
+            gpio_edge_t event;
+            if (gpio_read_event(app_state.io.buttons[i], &event, NULL) < 0) {
+                TRACE("Error reading event from button_%lu: %s\n", i, gpio_errmsg(app_state.io.buttons[i]));
+
+                CleanUp();
+                exit(EXIT_FAILURE);
+            }
+
+            struct timespec current_time;
+            if (clock_gettime(CLOCK_MONOTONIC, &current_time) < 0) {
+                TRACE("Error getting current time for debounce\n");
+                continue;
+            }
+
+            if (ShouldTrigger(i, event, current_time) && app_state.io.callbacks[i] != NULL) {
+                should_poll = app_state.io.callbacks[i]();
+            }
+        }
+    }
+
+    return should_poll;
+}
+
+bool PollCdevButtons() {
+    io_state_t *io = &app_state.io;
+
+    if (io->cdev_events_count == 0) {
+        const ssize_t ret = GpioCdevReadEvents(&io->cdev_buttons, io->cdev_events, GPIO_CDEV_EVENT_BATCH);
+
+        if (ret < 0) {
+            TRACE("Error reading button events: %s\n", strerror(errno));
+
+            CleanUp();
+            exit(EXIT_FAILURE);
+        }
+
+        io->cdev_events_head = 0;
+        io->cdev_events_count = (size_t) ret;
+    }
+
+    /* stops right after callback requested phase change, remaining events belong to the next phase */
+    while (io->cdev_events_count > 0) {
+        const gpio_cdev_event_t *event = &io->cdev_events[io->cdev_events_head];
+        io->cdev_events_head++;
+        io->cdev_events_count--;
+
+        if (io->cdev_last_seqno != 0 && event->seqno != io->cdev_last_seqno + 1) {
+            TRACE("Kernel dropped %u button events!\n", event->seqno - io->cdev_last_seqno - 1);
+        }
+        io->cdev_last_seqno = event->seqno;
+
+        /* timestamps come from CLOCK_MONOTONIC, so no extra syscall is needed for debounce */
+        const struct timespec event_time = {
+            .tv_sec = (time_t) (event->timestamp_ns / 1000000000ULL),
+            .tv_nsec = (long) (event->timestamp_ns % 1000000000ULL),
+        };
+        const gpio_edge_t edge = event->rising ? GPIO_EDGE_RISING : GPIO_EDGE_FALLING;
+
+        if (ShouldTrigger(event->line_idx, edge, event_time) && io->callbacks[event->line_idx] != NULL) {
+            if (!io->callbacks[event->line_idx]()) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+void SetLedState(const size_t led_num, const int state) {
+    const uint64_t led_mask = (uint64_t) 1 << led_num;
+    SetLedBank(state ? (app_state.io.led_bits | led_mask) : (app_state.io.led_bits & ~led_mask));
+}
+
+void SetLedBank(const uint64_t bits) {
+    const uint64_t changed = (bits ^ app_state.io.led_bits) & ALL_LEDS_MASK;
+
+    if (changed == 0) {
+        return;
+    }
+
+    app_state.io.led_toggles += (uint64_t) __builtin_popcountll(changed);
+
+    if (app_state.io.led_backend == GPIO_BACKEND_MMAP) {
+        /* only changed lines are touched */
+        GpioMmapWrite(&app_state.io.mmap_regs, app_state.io.mmap_bank_masks[bits & changed],
+                      app_state.io.mmap_bank_masks[~bits & changed]);
+
+        app_state.io.led_bits = bits;
+        return;
+    }
+
+    if (app_state.io.led_backend == GPIO_BACKEND_CDEV) {
+        if (GpioCdevSetValues(&app_state.io.cdev_leds, changed, bits) < 0) {
+            TRACE("Error setting LEDs: %s\n", strerror(errno));
+
+            CleanUp();
+            exit(EXIT_FAILURE);
+        }
+
+        app_state.io.led_bits = bits;
+        return;
+    }
+
+    for (size_t i = 0; i < NUM_LEDS; i++) {
+        if (!((changed >> i) & 1)) {
+            continue;
+        }
+
+        if (gpio_write(app_state.io.leds[i], (bits >> i) & 1) < 0) {
+            TRACE("Error enabling LED: %s\n", gpio_errmsg(app_state.io.leds[i]));
+
+            CleanUp();
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    app_state.io.led_bits = bits;
+}
+
+uint64_t GetLedBank() {
+    uint64_t bits = 0;
+
+    if (app_state.io.led_backend == GPIO_BACKEND_MMAP) {
+        const uint32_t levels = GpioMmapLevels(&app_state.io.mmap_regs);
+
+        for (size_t i = 0; i < NUM_LEDS; i++) {
+            bits |= (uint64_t) ((levels >> kLedPins[i]) & 1) << i;
+        }
+
+        return bits;
+    }
+
+    if (app_state.io.led_backend == GPIO_BACKEND_CDEV) {
+        if (GpioCdevGetValues(&app_state.io.cdev_leds, ALL_LEDS_MASK, &bits) < 0) {
+            TRACE("Error reading LEDs: %s\n", strerror(errno));
+
+            CleanUp();
+            exit(EXIT_FAILURE);
+        }
+
+        return bits;
+    }
+
+    for (size_t i = 0; i < NUM_LEDS; i++) {
+        bool value;
+        if (gpio_read(app_state.io.leds[i], &value) < 0) {
+            TRACE("Error reading LED: %s\n", gpio_errmsg(app_state.io.leds[i]));
+
+            CleanUp();
+            exit(EXIT_FAILURE);
+        }
+
+        bits |= (uint64_t) value << i;
+    }
+
+    return bits;
+}
+
+uint64_t NibbleToLedBank(const uint64_t nibble) {
+    /* led 0 shows the most significant bit of the nibble */
+    return ((nibble & 0b1000) >> 3) | ((nibble & 0b0100) >> 1) | ((nibble & 0b0010) << 1) | ((nibble & 0b0001) << 3);
+}
+
+bool ArgInputButton0Callback() {
+    /* Move to exponent or next phase */
+    return FinishArgEntry();
+}
+
+bool ArgInputButton1Callback() {
+    /* Add 0 bit - simply move cursor */
+    if (app_state.args.arg_bit_idx < ArgMaxBits()) {
+        app_state.args.arg_bit_idx++;
+    }
+
+    DisplayLast4Bits();
+
+    return true;
+}
+
+bool ArgInputButton2Callback() {
+    /* Add 1 bit */
+    if (app_state.args.arg_bit_idx < ArgMaxBits()) {
+        app_state.args.args[app_state.args.cur_arg] |= ((uint64_t) 1 << app_state.args.arg_bit_idx);
+        app_state.args.arg_bit_idx++;
+    }
+
+    DisplayLast4Bits();
+
+    return true;
+}
+
+bool ArgInputButton3Callback() {
+    /* sign gesture - remove on empty argument */
+    if (CalcIsSignedMode(app_state.config.calc_mode) && app_state.args.arg_bit_idx == 0) {
+        ToggleArgSign();
+        return true;
+    }
+
+    /* remove last added bit */
+    if (app_state.args.arg_bit_idx > 0) {
+        app_state.args.arg_bit_idx--;
+
+        const uint64_t mask = ~((uint64_t) 1 << app_state.args.arg_bit_idx);
+        app_state.args.args[app_state.args.cur_arg] &= mask;
+    }
+
+    DisplayLast4Bits();
+
+    return true;
+}
+
+/*
+ * Every digit costs two or three presses: 0-2 and 5-7 take two, 3, 4, 8 and 9 take three.
+ * Ten digit operand takes about 25 presses including the one that moves on, binary needs 34 bits for it.
+ */
+
+bool DecInputButton0Callback() {
+    /* Commit first digit of the window, move to next phase when no window is open */
+    if (app_state.args.pending_touched) {
+        CommitWindowDigit(0);
+        DisplayPendingDigit();
+        return true;
+    }
+
+    return FinishArgEntry();
+}
+
+bool DecInputButton1Callback() {
+    /* Open window at 0, or move it to the next three digits */
+    if (app_state.args.pending_touched) {
+        app_state.args.pending_digit = (app_state.args.pending_digit + DECIMAL_WINDOW_WIDTH) % 10;
+    } else {
+        app_state.args.pending_digit = 0;
+        app_state.args.pending_touched = true;
+    }
+
+    DisplayPendingDigit();
+
+    return true;
+}
+
+bool DecInputButton2Callback() {
+    /* Open window at 5, or commit second digit of the window */
+    if (app_state.args.pending_touched) {
+        CommitWindowDigit(1);
+    } else {
+        app_state.args.pending_digit = DECIMAL_HIGH_WINDOW;
+        app_state.args.pending_touched = true;
+    }
+
+    DisplayPendingDigit();
+
+    return true;
+}
+
+bool DecInputButton3Callback() {
+    /* Commit third digit of the window */
+    if (app_state.args.pending_touched) {
+        CommitWindowDigit(2);
+        DisplayPendingDigit();
+        return true;
+    }
+
+    /* sign gesture - delete on empty argument */
+    if (CalcIsSignedMode(app_state.config.calc_mode) && app_state.args.num_digits == 0) {
+        ToggleArgSign();
+        return true;
+    }
+
+    /* Remove the last committed digit */
+    if (app_state.args.num_digits > 0) {
+        app_state.args.args[app_state.args.cur_arg] /= 10;
+        app_state.args.num_digits--;
+    }
+
+    TraceArgument(app_state.args.args[app_state.args.cur_arg]);
+    DisplayPendingDigit();
+
+    return true;
+}
+
+bool CommitPendingDigit() {
+    uint64_t *arg = &app_state.args.args[app_state.args.cur_arg];
+    uint64_t value;
+
+    if (__builtin_mul_overflow(*arg, 10, &value) ||
+        __builtin_add_overflow(value, app_state.args.pending_digit, &value) ||
+        (ArgMaxBits() < ARG_MAX_BITS && (value >> ArgMaxBits()) != 0)) {
+        TRACE("Digit %u would overflow the argument, ignoring!\n", app_state.args.pending_digit);
+        return false;
+    }
+
+    *arg = value;
+    app_state.args.num_digits++;
+    app_state.args.pending_digit = 0;
+    app_state.args.pending_touched = false;
+
+    TraceArgument(*arg);
+    return true;
+}
+
+bool CommitWindowDigit(const uint8_t offset) {
+    const uint8_t window = app_state.args.pending_digit;
+
+    /* rejected digit leaves the window open where it was */
+    app_state.args.pending_digit = (uint8_t) ((window + offset) % 10);
+    if (!CommitPendingDigit()) {
+        app_state.args.pending_digit = window;
+        return false;
+    }
+
+    return true;
+}
+
+void TraceArgument(const uint64_t value) {
+    char decimal[NUMFMT_U64_MAX_DECIMAL_DIGITS + 1];
+    char hex[NUMFMT_U64_MAX_HEX_DIGITS + 1];
+
+    NumFmtU64ToDecimal(value, decimal);
+    NumFmtU64ToHex(value, hex);
+    TRACE("Argument: %s (0x%s)\n", decimal, hex);
+}
+
+void ResetArgEntry() {
+    const size_t arg_num = app_state.args.cur_arg;
+
+    app_state.args.arg_bit_idx = 0;
+    app_state.args.args[arg_num] = 0;
+    app_state.args.negative[arg_num] = false;
+    app_state.args.pending_digit = 0;
+    app_state.args.pending_touched = false;
+    app_state.args.num_digits = 0;
+    DisableAllLeds();
+}
+
+bool FinishArgEntry() {
+    const calc_mode_t mode = app_state.config.calc_mode;
+    const size_t arg_num = app_state.args.cur_arg;
+
+    if (!CalcIsRealMode(mode)) {
+        return false;
+    }
+
+    /* mantissa done, same buttons now enter the exponent */
+    if (!app_state.args.entering_exponent) {
+        app_state.args.mantissa[arg_num] = SignedArg(arg_num);
+        app_state.args.entering_exponent = true;
+        ResetArgEntry();
+
+        TRACE("Mantissa: %ld, enter exponent\n", app_state.args.mantissa[arg_num]);
+        return true;
+    }
+
+    const int64_t exponent = SignedArg(arg_num);
+    const uint32_t flags = CalcFromParts(mode, app_state.args.mantissa[arg_num], exponent,
+                                         &app_state.args.args[arg_num]);
+
+    /* args now hold encoded value, sign included */
+    app_state.args.negative[arg_num] = false;
+
+    char text[CALC_MAX_FORMATTED_LEN];
+    CalcFormatValue(mode, app_state.args.args[arg_num], text);
+    TRACE("Argument: %ldE%ld = %s%s\n", app_state.args.mantissa[arg_num], exponent, text,
+          (flags & CALC_FLAG_OVERFLOW) ? " (out of range!)" : "");
+
+    return false;
+}
+
+void PreviewStart() {
+    static const char *kPreviewNames[MULTIPLICATION + 1] = {"a + b", "a - b", "a * b"};
+
+    preview_state_t *preview = &app_state.preview;
+    const uint64_t a = EncodedArg(0);
+
+    /* only starting point is computed, entry steps then move it */
+    preview->operand = EncodedArg(1);
+    preview->showing = false;
+
+    for (size_t op = 0; op <= MULTIPLICATION; op++) {
+        preview->results[op] = CalcEvaluate(app_state.config.calc_mode, (operation_t) op, a, preview->operand).value;
+    }
+
+    for (size_t i = 0; i < NUM_BUTTONS; i++) {
+        preview->entry_callbacks[i] = app_state.io.callbacks[i];
+    }
+
+    app_state.io.callbacks[0] = PreviewButton0Callback;
+    app_state.io.callbacks[1] = PreviewButton1Callback;
+    app_state.io.callbacks[2] = PreviewButton2Callback;
+    app_state.io.callbacks[3] = PreviewButton3Callback;
+
+    TRACE("Button 1: show low nibble of %s entered so far, press again to proceed\n",
+          kPreviewNames[app_state.config.preview_op]);
+}
+
+void PreviewUpdate() {
+    preview_state_t *preview = &app_state.preview;
+    const uint64_t operand = EncodedArg(1);
+
+    if (app_state.config.calc_mode.number_mode == NUMBER_MODE_MODULAR) {
+        /* residues can't wrap with the operand, so the change is applied by its direction */
+        const mod_context_t *mod = app_state.config.calc_mode.mod;
+        const bool grows = operand >= preview->operand;
+        const uint64_t delta = ModReduce(mod, grows ? operand - preview->operand : preview->operand - operand);
+        const uint64_t scaled = ModMul(mod, EncodedArg(0), delta);
+
+        preview->results[ADDITION] = grows ? ModAdd(mod, preview->results[ADDITION], delta)
+                                           : ModSub(mod, preview->results[ADDITION], delta);
+        preview->results[SUBTRACTION] = grows ? ModSub(mod, preview->results[SUBTRACTION], delta)
+                                              : ModAdd(mod, preview->results[SUBTRACTION], delta);
+        preview->results[MULTIPLICATION] = grows ? ModAdd(mod, preview->results[MULTIPLICATION], scaled)
+                                                 : ModSub(mod, preview->results[MULTIPLICATION], scaled);
+    } else {
+        /* two's complement wraps, so negative deltas and signed operands need no special case */
+        const uint64_t delta = operand - preview->operand;
+
+        preview->results[ADDITION] += delta;
+        preview->results[SUBTRACTION] -= delta;
+        preview->results[MULTIPLICATION] += EncodedArg(0) * delta;
+    }
+
+    preview->operand = operand;
+}
+
+bool PreviewButton0Callback() {
+    preview_state_t *preview = &app_state.preview;
+
+    /* second press proceeds as the regular button would */
+    if (preview->showing) {
+        preview->showing = false;
+        return preview->entry_callbacks[0]();
+    }
+
+    /* first digit of the open window counts as entered, as button 1 would commit it */
+    if (app_state.config.entry_mode == ENTRY_MODE_DECIMAL && app_state.args.pending_touched) {
+        CommitPendingDigit();
+        PreviewUpdate();
+    }
+
+    const uint64_t nibble = preview->results[app_state.config.preview_op] & ALL_LEDS_MASK;
+
+    TRACE("Preview: low nibble %lx\n", nibble);
+    SetLedBank(NibbleToLedBank(nibble));
+    preview->showing = true;
+
+    return true;
+}
+
+bool PreviewButton1Callback() {
+    app_state.preview.showing = false;
+
+    const bool ret = app_state.preview.entry_callbacks[1]();
+    PreviewUpdate();
+
+    return ret;
+}
+
+bool PreviewButton2Callback() {
+    app_state.preview.showing = false;
+
+    const bool ret = app_state.preview.entry_callbacks[2]();
+    PreviewUpdate();
+
+    return ret;
+}
+
+bool PreviewButton3Callback() {
+    app_state.preview.showing = false;
+
+    const bool ret = app_state.preview.entry_callbacks[3]();
+    PreviewUpdate();
+
+    return ret;
+}
+
+bool OpInputButton0Callback() {
+    /* Move to next step */
+    return false;
+}
+
+bool OpInputButton1Callback() {
+    /* Pick next operation */
+    app_state.operation++;
+    app_state.operation %= LAST_OPERATION;
+
+    DisplayOperation();
+
+    return true;
+}
+
+bool BrowseButton0Callback() {
+    /* Finish browsing */
+    return false;
+}
+
+bool BrowseButton1Callback() {
+    /* Page towards lsb */
+    if (app_state.browse_nibble_idx > 0) {
+        app_state.browse_nibble_idx--;
+    }
+
+    DisplayBrowsedNibble();
+
+    return true;
+}
+
+bool BrowseButton2Callback() {
+    /* Page towards msb */
+    if (app_state.browse_nibble_idx + 1 < NUM_RESULT_NIBBLES) {
+        app_state.browse_nibble_idx++;
+    }
+
+    DisplayBrowsedNibble();
+
+    return true;
+}
+
+bool BrowseButton3Callback() {
+    /* Show index, then get back to the nibble, index 0 blinks as in delta display instead of staying dark */
+    const display_frame_t index_frame = {
+        .kind = app_state.browse_nibble_idx == 0 ? FRAME_ZERO : FRAME_COUNT,
+        .value = app_state.browse_nibble_idx,
+    };
+
+    DisableAllLeds();
+    PresentFrame(&index_frame);
+    DisplayBrowsedNibble();
+
+    return true;
+}
+
+bool RpnButton0Callback() {
+    /* Replace two topmost operands with result of the operation, nothing is displayed */
+    if (app_state.rpn.depth < 2) {
+        TRACE("Operation needs two operands, stack holds %lu!\n", app_state.rpn.depth);
+        return true;
+    }
+
+    const uint64_t b = app_state.rpn.stack[--app_state.rpn.depth];
+    const uint64_t a = app_state.rpn.stack[--app_state.rpn.depth];
+    const calc_result_t result = Calculate(app_state.operation, a, b);
+
+    app_state.rpn.flags |= result.flags;
+    RpnPush(result.value);
+
+    return true;
+}
+
+bool RpnButton1Callback() {
+    /* Pick next operation */
+    return OpInputButton1Callback();
+}
+
+bool RpnButton2Callback() {
+    /* Push another operand */
+    app_state.rpn.next_phase = ARG_INPUT_FIRST;
+    return false;
+}
+
+bool RpnButton3Callback() {
+    /* Show the result */
+    app_state.rpn.next_phase = ARG_DISPLAY;
+    return false;
+}
+
+bool RpnPush(const uint64_t value) {
+    if (app_state.rpn.depth == app_state.config.rpn_depth) {
+        TRACE("Operand stack full (%lu), operand dropped!\n", app_state.rpn.depth);
+        return false;
+    }
+
+    app_state.rpn.stack[app_state.rpn.depth++] = value;
+    return true;
+}
+
+calc_result_t RpnPopResult() {
+    /* shown result ends the expression, whatever was left below it is discarded */
+    const calc_result_t result = {
+        .value = app_state.rpn.depth > 0 ? app_state.rpn.stack[app_state.rpn.depth - 1] : 0,
+        .flags = app_state.rpn.flags,
+    };
+
+    if (app_state.rpn.depth > 1) {
+        TRACE("Discarding %lu operands below the result\n", app_state.rpn.depth - 1);
+    }
+
+    app_state.rpn.depth = 0;
+    app_state.rpn.flags = 0;
+    app_state.operation = ADDITION;
+
+    return result;
+}
+
+bool MacroButton0Callback() {
+    /* Steps already applied while recording, otherwise apply whole macro at once */
+    if (app_state.macro.recording) {
+        app_state.macro.recording = false;
+        TRACE("Recorded macro of %lu steps\n", app_state.macro.macro.num_steps);
+        return false;
+    }
+
+    if (app_state.macro.macro.num_steps == 0) {
+        TRACE("No macro recorded!\n");
+        return true;
+    }
+
+    const calc_result_t result = MacroReplay(&app_state.macro.macro, app_state.macro.value);
+    app_state.macro.value = result.value;
+    app_state.macro.flags |= result.flags;
+
+    return false;
+}
+
+bool MacroButton1Callback() {
+    /* Enter constant operand and operation of next step */
+    if (!app_state.macro.recording) {
+        app_state.macro.macro.num_steps = 0;
+        app_state.macro.macro.ops = 0;
+        app_state.macro.recording = true;
+    }
+
+    if (app_state.macro.macro.num_steps == MACRO_MAX_STEPS) {
+        TRACE("Macro is full (%d steps)!\n", MACRO_MAX_STEPS);
+        return true;
+    }
+
+    app_state.macro.next_phase = ARG_INPUT_SECOND;
+    return false;
+}
+
+bool MacroButton2Callback() {
+    /* Show value without replay, unfinished recording is dropped */
+    if (app_state.macro.recording) {
+        app_state.macro.recording = false;
+        app_state.macro.macro.num_steps = 0;
+        app_state.macro.macro.ops = 0;
+    }
+
+    return false;
+}
+
+bool MacroButton3Callback() {
+    /* Forget macro */
+    app_state.macro.recording = false;
+    app_state.macro.macro.num_steps = 0;
+    app_state.macro.macro.ops = 0;
+
+    TRACE("Macro cleared\n");
+    SetLedBank(0);
+
+    return true;
+}
+
+bool MacroAppendStep(macro_t *macro, const operation_t op, const uint64_t operand) {
+    if (macro->num_steps == MACRO_MAX_STEPS) {
+        return false;
+    }
+
+    macro->operands[macro->num_steps] = operand;
+    macro->ops |= ((uint32_t) op & MACRO_OP_MASK) << (macro->num_steps * MACRO_OP_BITS);
+    macro->num_steps++;
+
+    return true;
+}
+
+operation_t MacroStepOperation(const macro_t *macro, const size_t step) {
+    return (operation_t) ((macro->ops >> (step * MACRO_OP_BITS)) & MACRO_OP_MASK);
+}
+
+calc_result_t MacroReplay(const macro_t *macro, const uint64_t value) {
+    calc_result_t result = {.value = value, .flags = 0};
+
+    for (size_t i = 0; i < macro->num_steps; i++) {
+        const calc_result_t step = Calculate(MacroStepOperation(macro, i), result.value, macro->operands[i]);
+
+        result.value = step.value;
+        result.flags |= step.flags;
+    }
+
+    return result;
+}
+
+calc_result_t Calculate(const operation_t op, const uint64_t a, const uint64_t b) {
+    static const char *kOperationNames[LAST_OPERATION] = {"addition", "subtraction", "multiplication", "division"};
+    static const char kOperationSymbols[LAST_OPERATION] = {'+', '-', '*', '/'};
+    static const char *kModularOperationNames[LAST_OPERATION] = {
+        "modular addition", "modular subtraction", "modular multiplication", "modular exponentiation"
+    };
+    static const char kModularOperationSymbols[LAST_OPERATION] = {'+', '-', '*', '^'};
+
+    if (op >= LAST_OPERATION) {
+        CleanUp();
+        exit(EXIT_FAILURE);
+    }
+
+    const calc_mode_t mode = app_state.config.calc_mode;
+
+    char a_text[CALC_MAX_FORMATTED_LEN];
+    char b_text[CALC_MAX_FORMATTED_LEN];
+    CalcFormatValue(mode, a, a_text);
+    CalcFormatValue(mode, b, b_text);
+
+    if (mode.number_mode == NUMBER_MODE_MODULAR) {
+        TRACE("Calculating %s: %s %c %s mod %lu\n", kModularOperationNames[op], a_text, kModularOperationSymbols[op],
+              b_text, mode.mod->modulus);
+    } else {
+        TRACE("Calculating %s: %s %c %s\n", kOperationNames[op], a_text, kOperationSymbols[op], b_text);
+    }
+    const calc_result_t result = IsSpeculated(a, b) ? app_state.speculation.results[op] : CalcEvaluate(mode, op, a, b);
+
+    if (result.flags & CALC_FLAG_DIV_BY_ZERO) {
+        TRACE("Division by zero!\n");
+    }
+
+    if (result.flags & CALC_FLAG_OVERFLOW) {
+        TRACE("Result overflowed!\n");
+    }
+
+    return result;
+}
+
+void Speculate(const uint64_t a, const uint64_t b) {
+    speculation_t *speculation = &app_state.speculation;
+    struct timespec start;
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    speculation->args[0] = a;
+    speculation->args[1] = b;
+    speculation->has_schedules = !app_state.config.browse_result;
+
+    for (size_t op = 0; op < LAST_OPERATION; op++) {
+        speculation->results[op] = CalcEvaluate(app_state.config.calc_mode, (operation_t) op, a, b);
+
+        if (speculation->has_schedules) {
+            BuildDisplaySchedule(&speculation->schedules[op], speculation->results[op]);
+        }
+    }
+
+    speculation->valid = true;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    TRACE("Precomputed %d results%s in %ld ns\n", LAST_OPERATION,
+          speculation->has_schedules ? " and schedules" : "",
+          (end.tv_sec - start.tv_sec) * 1000000000L + (end.tv_nsec - start.tv_nsec));
+}
+
+bool IsSpeculated(const uint64_t a, const uint64_t b) {
+    const speculation_t *speculation = &app_state.speculation;
+    return speculation->valid && speculation->args[0] == a && speculation->args[1] == b;
+}
+
+uint64_t EncodedArg(const size_t arg_num) {
+    /* fixed point and float args are already encoded by FinishArgEntry */
+    if (app_state.config.calc_mode.number_mode == NUMBER_MODE_SIGNED) {
+        return (uint64_t) SignedArg(arg_num);
+    }
+
+    return app_state.args.args[arg_num];
+}
+
+int64_t SignedArg(const size_t arg_num) {
+    const uint64_t magnitude = app_state.args.args[arg_num];
+    const bool negative = app_state.args.negative[arg_num];
+
+    /* -2^63 is the only magnitude above INT64_MAX that still fits */
+    if (magnitude > (uint64_t) INT64_MAX + negative) {
+        TRACE("Argument %lu does not fit signed 64-bit range, wrapping!\n", arg_num);
+    }
+
+    return (int64_t) (negative ? (uint64_t) 0 - magnitude : magnitude);
+}
+
+size_t ArgMaxBits() {
+    /* sign is entered aside, so magnitude has one bit less */
+    return CalcIsSignedMode(app_state.config.calc_mode) ? SIGNED_ARG_MAX_BITS : ARG_MAX_BITS;
+}
+
+void ToggleArgSign() {
+    bool *negative = &app_state.args.negative[app_state.args.cur_arg];
+    *negative = !*negative;
+
+    TRACE("Argument sign: %c\n", *negative ? '-' : '+');
+    SetLedBank(*negative ? SIGN_NEGATIVE_BANK : 0);
+}
+
+void BuildDisplaySchedule(display_schedule_t *schedule, const calc_result_t calc_result) {
+    schedule->num_frames = 0;
+
+    /* raw bit patterns are compared, so delta works the same in every number mode */
+    if (app_state.config.display_mode == DISPLAY_MODE_DELTA) {
+        BuildDeltaSchedule(schedule, calc_result, app_state.last_displayed);
+
+        if (app_state.config.frame_encoding == FRAME_ENCODING_MIN_TOGGLE) {
+            EncodeMinToggleSchedule(schedule);
+        }
+        return;
+    }
+
+    /* fixed point and float results have layout of their own, leds show hex nibble groups */
+    switch (app_state.config.calc_mode.number_mode) {
+        case NUMBER_MODE_FIXED:
+            BuildFixedSchedule(schedule, calc_result, app_state.config.calc_mode.frac_bits);
+            return;
+        case NUMBER_MODE_FLOAT:
+            BuildFloatSchedule(schedule, calc_result);
+            return;
+        case NUMBER_MODE_UNSIGNED:
+        case NUMBER_MODE_SIGNED:
+        case NUMBER_MODE_MODULAR:
+        case LAST_NUMBER_MODE:
+            break;
+    }
+
+    /* signed results are shown as sign frame followed by magnitude */
+    uint64_t result = calc_result.value;
+
+    if (app_state.config.calc_mode.number_mode == NUMBER_MODE_SIGNED) {
+        const bool negative = (int64_t) result < 0;
+        const bool overflow = (calc_result.flags & CALC_FLAG_OVERFLOW) != 0;
+
+        result = negative ? (uint64_t) 0 - result : result;
+        PushFrame(schedule, FRAME_SIGN, (uint64_t) negative | ((uint64_t) overflow << 1));
+    }
+
+    schedule->num_bits = result == 0 ? 1 : (size_t) (64 - __builtin_clzll(result));
+
+    switch (app_state.config.display_mode) {
+        case DISPLAY_MODE_BINARY:
+            BuildBinarySchedule(schedule, result);
+            break;
+        case DISPLAY_MODE_PWM:
+            BuildPwmSchedule(schedule, result, app_state.config.pwm_levels);
+            break;
+        case DISPLAY_MODE_RLE:
+            BuildRleSchedule(schedule, result);
+            break;
+        case DISPLAY_MODE_DECIMAL:
+            BuildDecimalSchedule(schedule, result);
+            break;
+        case DISPLAY_MODE_DELTA:
+        case LAST_DISPLAY_MODE:
+            CleanUp();
+            exit(EXIT_FAILURE);
+    }
+
+    if (app_state.config.frame_encoding == FRAME_ENCODING_MIN_TOGGLE) {
+        EncodeMinToggleSchedule(schedule);
+    }
+}
+
+void BuildBinarySchedule(display_schedule_t *schedule, const uint64_t result) {
+    if (result == 0) {
+        PushFrame(schedule, FRAME_BIT, 0);
+        return;
+    }
+
+    int msb = 63;
+    while (msb >= 0 && !(result & ((uint64_t) 1 << msb))) {
+        msb--;
+    }
+
+    for (int cur = msb; cur >= 0; cur--) {
+        PushFrame(schedule, FRAME_BIT, (result >> cur) & 1);
+    }
+}
+
+void BuildPwmSchedule(display_schedule_t *schedule, const uint64_t result, const unsigned levels) {
+    /* every led shows one base-levels digit, so each frame carries NUM_LEDS digits */
+    uint8_t digits[64];
+    size_t num_digits = 0;
+
+    uint64_t rest = result;
+    do {
+        digits[num_digits++] = (uint8_t) (rest % levels);
+        rest /= levels;
+    } while (rest != 0);
+
+    const size_t num_frames = (num_digits + NUM_LEDS - 1) / NUM_LEDS;
+    for (size_t i = num_digits; i < num_frames * NUM_LEDS; i++) {
+        digits[i] = 0;
+    }
+
+    /* most significant frame first, led 0 holds most significant digit of the frame */
+    for (size_t frame = num_frames; frame-- > 0;) {
+        uint64_t packed = 0;
+
+        for (size_t led = 0; led < NUM_LEDS; led++) {
+            packed |= (uint64_t) digits[frame * NUM_LEDS + (NUM_LEDS - 1 - led)] << (led * PWM_LEVEL_BITS);
+        }
+
+        PushFrame(schedule, FRAME_LEVELS, packed);
+    }
 }
 
-void EnableLed(const size_t led_num) {
-    SetLedState(led_num, 1);
+void BuildRleSchedule(display_schedule_t *schedule, const uint64_t result) {
+    if (result == 0) {
+        PushFrame(schedule, FRAME_BIT, 0);
+        return;
+    }
+
+    const uint64_t bit_ms = FrameDurationMs(FRAME_BIT);
+    const uint64_t pair_ms = FrameDurationMs(FRAME_COUNT) + bit_ms;
+
+    int cur = 63 - __builtin_clzll(result);
+
+    while (cur >= 0) {
+        const uint64_t bit = (result >> cur) & 1;
+
+        /* length of the run of equal bits starting at cur, going towards lsb */
+        const uint64_t rest = bit ? ~result : result;
+        const uint64_t below = cur == 63 ? rest : rest & (((uint64_t) 1 << (cur + 1)) - 1);
+        const int run_end = below == 0 ? -1 : 63 - __builtin_clzll(below);
+        uint64_t run = (uint64_t) (cur - run_end);
+
+        cur = run_end;
+
+        /* count frame holds at most a nibble, longer runs are split */
+        while (run > 0) {
+            const uint64_t chunk = run > RLE_MAX_RUN_PER_FRAME ? RLE_MAX_RUN_PER_FRAME : run;
+            run -= chunk;
+
+            if (pair_ms < chunk * bit_ms) {
+                PushFrame(schedule, FRAME_COUNT, chunk);
+                PushFrame(schedule, FRAME_BIT, bit);
+                continue;
+            }
+
+            for (uint64_t i = 0; i < chunk; i++) {
+                PushFrame(schedule, FRAME_BIT, bit);
+            }
+        }
+    }
 }
 
-bool ArgInputButton0Callback() {
-    /* Move to next phase */
-    return false;
+void BuildDecimalSchedule(display_schedule_t *schedule, const uint64_t result) {
+    char digits[NUMFMT_U64_MAX_DECIMAL_DIGITS + 1];
+    const size_t num_digits = NumFmtU64ToDecimal(result, digits);
+
+    /* dark frame would be lost in the blank gap, 0 takes pattern BCD never uses */
+    for (size_t i = 0; i < num_digits; i++) {
+        const uint64_t digit = (uint64_t) (digits[i] - '0');
+        PushFrame(schedule, FRAME_NIBBLE, digit == 0 ? DECIMAL_ZERO_NIBBLE : digit);
+    }
 }
 
-bool ArgInputButton1Callback() {
-    /* Add 0 bit - simply move cursor */
-    if (app_state.args.arg_bit_idx < 64) {
-        app_state.args.arg_bit_idx++;
+void BuildDeltaSchedule(display_schedule_t *schedule, const calc_result_t calc_result, const uint64_t previous) {
+    const uint64_t result = calc_result.value;
+    const uint64_t changed = result ^ previous;
+
+    schedule->num_bits = 0;
+
+    /* sign frame is the only overflow indication, so it is kept as full display of signed modes has it */
+    if (CalcIsSignedMode(app_state.config.calc_mode)) {
+        const bool negative = (result >> 63) != 0;
+        const bool overflow = (calc_result.flags & CALC_FLAG_OVERFLOW) != 0;
+
+        PushFrame(schedule, FRAME_SIGN, (uint64_t) negative | ((uint64_t) overflow << 1));
     }
 
-    DisplayLast4Bits();
+    /* single flash tells that nothing changed */
+    if (changed == 0) {
+        PushFrame(schedule, FRAME_SEPARATOR, 0);
+        return;
+    }
 
-    return true;
+    /*
+     * Changed nibbles from the most significant one, each preceded by its blinking index as browsing shows it.
+     * Index and value 0 would be dark frames lost in the blank gap, both are shown as fast blinking instead.
+     */
+    for (size_t nibble = NUM_RESULT_NIBBLES; nibble-- > 0;) {
+        const size_t shift = nibble * NIBBLE_BITS;
+        const uint64_t value = (result >> shift) & ALL_LEDS_MASK;
+
+        if (((changed >> shift) & ALL_LEDS_MASK) == 0) {
+            continue;
+        }
+
+        if (nibble == 0) {
+            PushFrame(schedule, FRAME_ZERO, 0);
+        } else {
+            PushFrame(schedule, FRAME_COUNT, nibble);
+        }
+
+        if (value == 0) {
+            PushFrame(schedule, FRAME_ZERO, 0);
+        } else {
+            PushFrame(schedule, FRAME_NIBBLE, value);
+        }
+
+        schedule->num_bits += NIBBLE_BITS;
+    }
 }
 
-bool ArgInputButton2Callback() {
-    /* Add 1 bit */
-    if (app_state.args.arg_bit_idx < 64) {
-        app_state.args.args[app_state.args.cur_arg] |= ((uint64_t) 1 << app_state.args.arg_bit_idx);
-        app_state.args.arg_bit_idx++;
+void BuildFixedSchedule(display_schedule_t *schedule, const calc_result_t result, const unsigned frac_bits) {
+    /* sign, integer nibbles, separator, fraction nibbles with trailing zeros dropped */
+    const bool negative = (int64_t) result.value < 0;
+    const bool overflow = (result.flags & CALC_FLAG_OVERFLOW) != 0;
+    const uint64_t magnitude = negative ? (uint64_t) 0 - result.value : result.value;
+
+    PushFrame(schedule, FRAME_SIGN, (uint64_t) negative | ((uint64_t) overflow << 1));
+
+    const uint64_t integer = magnitude >> frac_bits;
+    const size_t integer_bits = integer == 0 ? 1 : (size_t) (64 - __builtin_clzll(integer));
+    PushNibbles(schedule, integer, (integer_bits + NIBBLE_BITS - 1) / NIBBLE_BITS);
+
+    /* fraction is left aligned so that its first nibble always means halves, quarters, ... */
+    const size_t frac_nibbles = (frac_bits + NIBBLE_BITS - 1) / NIBBLE_BITS;
+    uint64_t fraction = frac_bits == 0 ? 0 : magnitude & (((uint64_t) 1 << frac_bits) - 1);
+    fraction <<= frac_nibbles * NIBBLE_BITS - frac_bits;
+
+    size_t num_bits = integer_bits;
+    if (fraction != 0) {
+        const size_t trailing = (size_t) __builtin_ctzll(fraction) / NIBBLE_BITS;
+
+        PushFrame(schedule, FRAME_SEPARATOR, 0);
+        PushNibbles(schedule, fraction >> (trailing * NIBBLE_BITS), frac_nibbles - trailing);
+        num_bits += (frac_nibbles - trailing) * NIBBLE_BITS;
     }
 
-    DisplayLast4Bits();
+    schedule->num_bits = num_bits;
+}
 
-    return true;
+void BuildFloatSchedule(display_schedule_t *schedule, const calc_result_t result) {
+    /* biased exponent first - it tells the magnitude before any mantissa nibble is shown */
+    const uint64_t exponent = (result.value >> 52) & 0x7ff;
+    const uint64_t mantissa = result.value & (((uint64_t) 1 << 52) - 1);
+    const bool negative = (result.value >> 63) != 0;
+    const bool overflow = (result.flags & CALC_FLAG_OVERFLOW) != 0;
+
+    PushNibbles(schedule, exponent, FLOAT_EXPONENT_NIBBLES);
+    PushFrame(schedule, FRAME_SIGN, (uint64_t) negative | ((uint64_t) overflow << 1));
+
+    /* exact powers of two need a single mantissa frame */
+    const size_t trailing = mantissa == 0 ? FLOAT_MANTISSA_NIBBLES - 1
+                                          : (size_t) __builtin_ctzll(mantissa) / NIBBLE_BITS;
+    PushNibbles(schedule, mantissa >> (trailing * NIBBLE_BITS), FLOAT_MANTISSA_NIBBLES - trailing);
+
+    schedule->num_bits = (FLOAT_EXPONENT_NIBBLES + FLOAT_MANTISSA_NIBBLES - trailing) * NIBBLE_BITS + 1;
 }
 
-bool ArgInputButton3Callback() {
-    /* remove last added bit */
-    if (app_state.args.arg_bit_idx > 0) {
-        app_state.args.arg_bit_idx--;
+void PushNibbles(display_schedule_t *schedule, const uint64_t value, const size_t num_nibbles) {
+    /* most significant nibble first */
+    for (size_t i = num_nibbles; i-- > 0;) {
+        PushFrame(schedule, FRAME_NIBBLE, (value >> (i * NIBBLE_BITS)) & ALL_LEDS_MASK);
+    }
+}
 
-        const uint64_t mask = ~((uint64_t) 1 << app_state.args.arg_bit_idx);
-        app_state.args.args[app_state.args.cur_arg] &= mask;
+void PushFrame(display_schedule_t *schedule, const frame_kind_t kind, const uint64_t value) {
+    assert(schedule->num_frames < DISPLAY_MAX_FRAMES);
+
+    schedule->frames[schedule->num_frames].kind = kind;
+    schedule->frames[schedule->num_frames].value = value;
+    schedule->num_frames++;
+}
+
+void EncodeMinToggleSchedule(display_schedule_t *schedule) {
+    /*
+     * Bit frames become raw bank frames: leds 0 and 1 hold the bit, leds 2 and 3 hold gray coded
+     * frame counter. Consecutive frames differ in exactly one clock line plus data lines only when
+     * the bit changes, instead of lighting and blanking two lines per bit.
+     */
+    size_t bit_idx = 0;
+
+    for (size_t i = 0; i < schedule->num_frames; i++) {
+        display_frame_t *frame = &schedule->frames[i];
+
+        if (frame->kind != FRAME_BIT) {
+            continue;
+        }
+
+        /*
+         * Counter runs 01, 11, 10 and wraps to 01, so no frame has dark clock lines and 0 bit never
+         * looks like the blank bank. The wrap is the only step flipping both clock lines.
+         */
+        const uint64_t clock = GrayCode(bit_idx % GRAY_CLOCK_STATES + 1) << GRAY_CLOCK_SHIFT;
+        const uint64_t data = frame->value ? GRAY_DATA_MASK : 0;
+
+        frame->kind = FRAME_BANK;
+        frame->value = clock | data;
+        bit_idx++;
     }
+}
 
-    DisplayLast4Bits();
+uint64_t GrayCode(const uint64_t value) {
+    return value ^ (value >> 1);
+}
 
-    return true;
+uint64_t FrameDurationMs(const frame_kind_t kind) {
+    switch (kind) {
+        case FRAME_BIT:
+        case FRAME_LEVELS:
+        case FRAME_NIBBLE:
+        case FRAME_SIGN:
+        case FRAME_ZERO:
+            return PRESENTATION_BIT_TIME_MS + PRESENTATION_BLANK_LEDS_MS;
+        case FRAME_BANK:
+            return PRESENTATION_BIT_TIME_MS;
+        case FRAME_SEPARATOR:
+            return PRESENTATION_SEPARATOR_MS + PRESENTATION_BLANK_LEDS_MS;
+        case FRAME_COUNT:
+            return PRESENTATION_COUNT_BLINKS * (PRESENTATION_COUNT_ON_MS + PRESENTATION_COUNT_OFF_MS) +
+                   PRESENTATION_BLANK_LEDS_MS;
+        case LAST_FRAME_KIND:
+            break;
+    }
+
+    return 0;
 }
 
-bool OpInputButton0Callback() {
-    /* Move to next step */
-    return false;
+uint64_t ScheduleDurationMs(const display_schedule_t *schedule) {
+    uint64_t duration_ms = 0;
+
+    for (size_t i = 0; i < schedule->num_frames; i++) {
+        duration_ms += FrameDurationMs(schedule->frames[i].kind);
+    }
+
+    return duration_ms;
 }
 
-bool OpInputButton1Callback() {
-    /* Pick next operation */
-    app_state.operation++;
-    app_state.operation %= LAST_OPERATION;
+void PresentSchedule(const display_schedule_t *schedule) {
+    const uint64_t toggles_before = app_state.io.led_toggles;
+
+    /* summed over all runs of levels frames */
+    uint64_t pwm_toggles = 0;
+    uint64_t pwm_wakeups = 0;
+    uint64_t pwm_writes = 0;
+    uint64_t pwm_total_lateness_ns = 0;
+    uint64_t pwm_max_lateness_ns = 0;
+
+    size_t i = 0;
+    while (i < schedule->num_frames) {
+        if (schedule->frames[i].kind != FRAME_LEVELS) {
+            PresentFrame(&schedule->frames[i++]);
+            continue;
+        }
 
-    DisplayOperation();
+        /*
+         * pwm thread owns the leds only for a run of levels frames, which never touch the bank themselves,
+         * so every other frame is written by this thread alone
+         */
+        const uint64_t run_toggles_before = app_state.io.led_toggles;
+        if (PwmStart(&app_state.pwm, NUM_LEDS, app_state.config.pwm_levels, PWM_DEFAULT_PERIOD_US,
+                     PwmWriteLedBank, NULL) < 0) {
+            TRACE("Failed to start PWM engine!\n");
+            CleanUp();
+            exit(EXIT_FAILURE);
+        }
 
-    return true;
+        for (; i < schedule->num_frames && schedule->frames[i].kind == FRAME_LEVELS; i++) {
+            PresentFrame(&schedule->frames[i]);
+        }
+
+        /* joined thread - its bank writes and toggle counts are visible from here on */
+        PwmStop(&app_state.pwm);
+        DisableAllLeds();
+
+        const pwm_engine_t *pwm = &app_state.pwm;
+        pwm_toggles += app_state.io.led_toggles - run_toggles_before;
+        pwm_wakeups += pwm->num_wakeups;
+        pwm_writes += pwm->num_writes;
+        pwm_total_lateness_ns += pwm->total_lateness_ns;
+        pwm_max_lateness_ns = pwm->max_lateness_ns > pwm_max_lateness_ns ? pwm->max_lateness_ns : pwm_max_lateness_ns;
+    }
+
+    if (pwm_wakeups > 0) {
+        TRACE("PWM: %lu wakeups, %lu bank writes, %lu led toggles, lateness avg %lu ns, max %lu ns\n",
+              pwm_wakeups, pwm_writes, pwm_toggles, pwm_total_lateness_ns / pwm_wakeups, pwm_max_lateness_ns);
+    }
+
+    DisableAllLeds();
+
+    /* slot writes of pwm depend on its timing, not on the encoding, so they are left out */
+    const uint64_t toggles = app_state.io.led_toggles - toggles_before - pwm_toggles;
+    TRACE("Displayed %lu bits with %lu led toggles (%.2f per bit)\n", schedule->num_bits, toggles,
+          (double) toggles / (double) schedule->num_bits);
 }
 
-uint64_t Calculate() {
-    switch (app_state.operation) {
-        case ADDITION:
-            TRACE("Calculating addition: %lu + %lu\n", app_state.args.args[0], app_state.args.args[1]);
-            return app_state.args.args[0] + app_state.args.args[1];
-        case SUBTRACTION:
-            TRACE("Calculating subtraction: %lu - %lu\n", app_state.args.args[0], app_state.args.args[1]);
-            return app_state.args.args[0] - app_state.args.args[1];
-        case MULTIPLICATION:
-            TRACE("Calculating multiplication: %lu * %lu\n", app_state.args.args[0], app_state.args.args[1]);
-            return app_state.args.args[0] * app_state.args.args[1];
-        case DIVISION:
-            if (app_state.args.args[1] == 0) {
-                TRACE("Division by zero!\n");
-                return 0;
+void PresentFrame(const display_frame_t *frame) {
+    switch (frame->kind) {
+        case FRAME_BIT:
+            if (frame->value) {
+                Signal1Bit();
+            } else {
+                Signal0Bit();
+            }
+            break;
+        case FRAME_BANK:
+            SetLedBank(frame->value);
+            CHECKED_RUN(usleep(PRESENTATION_BIT_TIME_MS * 1000));
+            return;
+        case FRAME_NIBBLE:
+            SetLedBank(NibbleToLedBank(frame->value));
+            CHECKED_RUN(usleep(PRESENTATION_BIT_TIME_MS * 1000));
+            DisableAllLeds();
+            break;
+        case FRAME_SEPARATOR:
+            EnableAllLeds();
+            CHECKED_RUN(usleep(PRESENTATION_SEPARATOR_MS * 1000));
+            DisableAllLeds();
+            break;
+        case FRAME_SIGN: {
+            const uint64_t bank = (frame->value & 1) ? SIGN_NEGATIVE_BANK : SIGN_POSITIVE_BANK;
+
+            if (!(frame->value & 2)) {
+                SetLedBank(bank);
+                CHECKED_RUN(usleep(PRESENTATION_BIT_TIME_MS * 1000));
+                DisableAllLeds();
+                break;
+            }
+
+            /* overflow - same duration, but blinking */
+            for (size_t i = 0; i < PRESENTATION_SIGN_BLINKS; i++) {
+                SetLedBank(bank);
+                CHECKED_RUN(usleep(PRESENTATION_BIT_TIME_MS * 1000 / (2 * PRESENTATION_SIGN_BLINKS)));
+
+                DisableAllLeds();
+                CHECKED_RUN(usleep(PRESENTATION_BIT_TIME_MS * 1000 / (2 * PRESENTATION_SIGN_BLINKS)));
+            }
+            break;
+        }
+        case FRAME_ZERO:
+            /* same duration as nibble frame, fast blinking tells it apart from steady 0b1111 */
+            for (size_t i = 0; i < PRESENTATION_ZERO_BLINKS; i++) {
+                EnableAllLeds();
+                CHECKED_RUN(usleep(PRESENTATION_BIT_TIME_MS * 1000 / (2 * PRESENTATION_ZERO_BLINKS)));
+
+                DisableAllLeds();
+                CHECKED_RUN(usleep(PRESENTATION_BIT_TIME_MS * 1000 / (2 * PRESENTATION_ZERO_BLINKS)));
+            }
+            break;
+        case FRAME_COUNT:
+            for (size_t i = 0; i < PRESENTATION_COUNT_BLINKS; i++) {
+                SetLedBank(NibbleToLedBank(frame->value));
+                CHECKED_RUN(usleep(PRESENTATION_COUNT_ON_MS * 1000));
+
+                DisableAllLeds();
+                CHECKED_RUN(usleep(PRESENTATION_COUNT_OFF_MS * 1000));
+            }
+            break;
+        case FRAME_LEVELS: {
+            uint8_t levels[NUM_LEDS];
+            const uint8_t blank[NUM_LEDS] = {};
+
+            for (size_t led = 0; led < NUM_LEDS; led++) {
+                levels[led] = (frame->value >> (led * PWM_LEVEL_BITS)) & ((1 << PWM_LEVEL_BITS) - 1);
             }
-            TRACE("Calculating division: %lu / %lu\n", app_state.args.args[0], app_state.args.args[1]);
-            return app_state.args.args[0] / app_state.args.args[1];
-        case LAST_OPERATION:
+
+            PwmSetLevels(&app_state.pwm, levels);
+            CHECKED_RUN(usleep(PRESENTATION_BIT_TIME_MS * 1000));
+            PwmSetLevels(&app_state.pwm, blank);
+            break;
+        }
+        case LAST_FRAME_KIND:
             CleanUp();
             exit(EXIT_FAILURE);
     }
 
-    CleanUp();
-    exit(EXIT_FAILURE);
+    CHECKED_RUN(usleep(PRESENTATION_BLANK_LEDS_MS * 1000));
+}
+
+void PwmWriteLedBank(const uint64_t bits, void *ctx) {
+    (void) ctx;
+    SetLedBank(bits);
 }
 
 void ShineLeds() {
@@ -561,8 +2845,7 @@ void ShineLeds() {
 void Signal0Bit() {
     DisableAllLeds();
 
-    EnableLed(2);
-    EnableLed(3);
+    SetLedBank(0b1100);
 
     CHECKED_RUN(usleep(PRESENTATION_BIT_TIME_MS * 1000));
 
@@ -572,8 +2855,7 @@ void Signal0Bit() {
 void Signal1Bit() {
     DisableAllLeds();
 
-    EnableLed(0);
-    EnableLed(1);
+    SetLedBank(0b0011);
 
     CHECKED_RUN(usleep(PRESENTATION_BIT_TIME_MS * 1000));
 
@@ -581,15 +2863,11 @@ void Signal1Bit() {
 }
 
 void DisableAllLeds() {
-    for (size_t i = 0; i < NUM_LEDS; i++) {
-        DisableLed(i);
-    }
+    SetLedBank(0);
 }
 
 void EnableAllLeds() {
-    for (size_t i = 0; i < NUM_LEDS; i++) {
-        EnableLed(i);
-    }
+    SetLedBank(ALL_LEDS_MASK);
 }
 
 void DisplayLast4Bits() {
@@ -600,30 +2878,558 @@ void DisplayLast4Bits() {
     const uint64_t shifted_bits = app_state.args.args[app_state.args.cur_arg] & adjusted_mask;
     const uint64_t bits = shifted_bits >> shift;
 
-    SetLedState(0, (bits & 0b1000) > 0);
-    SetLedState(1, (bits & 0b0100) > 0);
-    SetLedState(2, (bits & 0b0010) > 0);
-    SetLedState(3, (bits & 0b0001) > 0);
+    SetLedBank(NibbleToLedBank(bits));
+}
+
+void DisplayPendingDigit() {
+    /* window at 0 lit as in decimal display, so it is told apart from no open window */
+    const uint64_t digit = app_state.args.pending_digit;
+    SetLedBank(NibbleToLedBank(app_state.args.pending_touched && digit == 0 ? DECIMAL_ZERO_NIBBLE : digit));
+}
+
+void DisplayBrowsedNibble() {
+    const uint64_t nibble = (app_state.result >> (app_state.browse_nibble_idx * NIBBLE_BITS)) & ALL_LEDS_MASK;
+
+    TRACE("Nibble %lu: %lx\n", app_state.browse_nibble_idx, nibble);
+    SetLedBank(NibbleToLedBank(nibble));
 }
 
 void DisplayOperation() {
-    const uint64_t bits = (uint64_t) app_state.operation;
+    uint64_t bits = (uint64_t) app_state.operation;
+
+    /* cycling through operations flips single led per press */
+    if (app_state.config.frame_encoding == FRAME_ENCODING_MIN_TOGGLE) {
+        bits = GrayCode(bits);
+    }
+
+    SetLedBank(NibbleToLedBank(bits));
+}
+
+bool ParseNumberArgument(const char *name, const char *text, uint64_t *value) {
+    /* decimal, or raw value after 0x / 0b prefix */
+    const char *digits = text;
+    unsigned radix = 10;
+    if (digits[0] == '0' && (digits[1] == 'x' || digits[1] == 'X')) {
+        radix = 16;
+        digits += 2;
+    } else if (digits[0] == '0' && (digits[1] == 'b' || digits[1] == 'B')) {
+        radix = 2;
+        digits += 2;
+    }
+
+    /* whole argument has to be a number that fits */
+    const char *end = NumFmtParseU64(digits, radix, value);
+    if (end == NULL || *end != '\0') {
+        TRACE("Invalid %s: %s\n", name, text);
+        return false;
+    }
+
+    return true;
+}
+
+bool ParseArguments(const int argc, char *argv[]) {
+    static const struct option kOptions[] = {
+        {"backend", required_argument, NULL, 'b'},
+        {"bench-gpio", optional_argument, NULL, 'B'},
+        {"gpiomem", optional_argument, NULL, 'm'},
+        {"display", required_argument, NULL, 'd'},
+        {"pwm-levels", required_argument, NULL, 'l'},
+        {"encoding", required_argument, NULL, 'e'},
+        {"browse", no_argument, NULL, 'r'},
+        {"entry", required_argument, NULL, 'i'},
+        {"signed", no_argument, NULL, 's'},
+        {"fixed", optional_argument, NULL, 'Q'},
+        {"float", no_argument, NULL, 'F'},
+        {"modulus", required_argument, NULL, 'N'},
+        {"batch", optional_argument, NULL, 'a'},
+        {"bench-batch", no_argument, NULL, 'A'},
+        {"expr", required_argument, NULL, 'x'},
+        {"rpn-expr", required_argument, NULL, 'X'},
+        {"threads", optional_argument, NULL, 'T'},
+        {"batch-format", required_argument, NULL, 'f'},
+        {"convert", required_argument, NULL, 'c'},
+        {"batch-radix", required_argument, NULL, 'k'},
+        {"batch-output", required_argument, NULL, 'o'},
+        {"batch-io", required_argument, NULL, 'O'},
+        {"rpn", optional_argument, NULL, 'R'},
+        {"macro", no_argument, NULL, 'M'},
+        {"preview", optional_argument, NULL, 'P'},
+        {"idle-timeout", optional_argument, NULL, 'I'},
+        {"panels", required_argument, NULL, 'p'},
+        {"shards", required_argument, NULL, 'S'},
+        {"handoff", required_argument, NULL, 'H'},
+        {"snapshot", required_argument, NULL, 'w'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+
+    int opt;
+    uint64_t number;
+    while ((opt = getopt_long(argc, argv, "b:d:l:e:ri:sh", kOptions, NULL)) != -1) {
+        switch (opt) {
+            case 'b':
+                if (strcmp(optarg, "cdev") == 0) {
+                    app_state.io.backend = GPIO_BACKEND_CDEV;
+                } else if (strcmp(optarg, "periphery") == 0) {
+                    app_state.io.backend = GPIO_BACKEND_PERIPHERY;
+                } else {
+                    TRACE("Unknown backend: %s\n", optarg);
+                    return false;
+                }
+                app_state.config.force_backend = true;
+                break;
+            case 'B':
+                number = GPIO_BENCH_DEFAULT_ITERATIONS;
+                if (optarg != NULL && !ParseNumberArgument("benchmark iterations", optarg, &number)) {
+                    return false;
+                }
+                app_state.config.bench_gpio_iterations = number;
+                break;
+            case 'm':
+                app_state.config.gpiomem_path = optarg != NULL ? optarg : GPIO_MMAP_DEV_PATH;
+                break;
+            case 'd':
+                if (strcmp(optarg, "binary") == 0) {
+                    app_state.config.display_mode = DISPLAY_MODE_BINARY;
+                } else if (strcmp(optarg, "pwm") == 0) {
+                    app_state.config.display_mode = DISPLAY_MODE_PWM;
+                } else if (strcmp(optarg, "rle") == 0) {
+                    app_state.config.display_mode = DISPLAY_MODE_RLE;
+                } else if (strcmp(optarg, "decimal") == 0) {
+                    app_state.config.display_mode = DISPLAY_MODE_DECIMAL;
+                } else if (strcmp(optarg, "delta") == 0) {
+                    app_state.config.display_mode = DISPLAY_MODE_DELTA;
+                } else {
+                    TRACE("Unknown display mode: %s\n", optarg);
+                    return false;
+                }
+                break;
+            case 'l':
+                if (!ParseNumberArgument("PWM levels", optarg, &number)) {
+                    return false;
+                }
+                if (number < PWM_MIN_LEVELS || number > PWM_MAX_LEVELS) {
+                    TRACE("PWM levels must be in range [%d, %d]\n", PWM_MIN_LEVELS, PWM_MAX_LEVELS);
+                    return false;
+                }
+                app_state.config.pwm_levels = (unsigned) number;
+                break;
+            case 'e':
+                if (strcmp(optarg, "plain") == 0) {
+                    app_state.config.frame_encoding = FRAME_ENCODING_PLAIN;
+                } else if (strcmp(optarg, "min-toggle") == 0) {
+                    app_state.config.frame_encoding = FRAME_ENCODING_MIN_TOGGLE;
+                } else {
+                    TRACE("Unknown frame encoding: %s\n", optarg);
+                    return false;
+                }
+                break;
+            case 'r':
+                app_state.config.browse_result = true;
+                break;
+            case 's':
+                app_state.config.calc_mode.number_mode = NUMBER_MODE_SIGNED;
+                break;
+            case 'Q':
+                app_state.config.calc_mode.number_mode = NUMBER_MODE_FIXED;
+                number = app_state.config.calc_mode.frac_bits;
+                if (optarg != NULL && !ParseNumberArgument("fraction bits", optarg, &number)) {
+                    return false;
+                }
+                if (number > CALC_MAX_FRAC_BITS) {
+                    TRACE("Fraction bits must be in range [0, %d]\n", CALC_MAX_FRAC_BITS);
+                    return false;
+                }
+                app_state.config.calc_mode.frac_bits = (unsigned) number;
+                break;
+            case 'F':
+                app_state.config.calc_mode.number_mode = NUMBER_MODE_FLOAT;
+                break;
+            case 'N':
+                if (!ParseNumberArgument("modulus", optarg, &number)) {
+                    return false;
+                }
+                if (!ModInit(&app_state.mod, number)) {
+                    TRACE("Modulus must be nonzero\n");
+                    return false;
+                }
+                app_state.config.calc_mode.number_mode = NUMBER_MODE_MODULAR;
+                app_state.config.calc_mode.mod = &app_state.mod;
+                break;
+            case 'a':
+                app_state.config.batch_path = optarg != NULL ? optarg : BATCH_STDIO_PATH;
+                break;
+            case 'A':
+                app_state.config.bench_batch = true;
+                break;
+            case 'x':
+                app_state.config.batch_expr = optarg;
+                app_state.config.batch_expr_syntax = EXPR_SYNTAX_INFIX;
+                break;
+            case 'X':
+                app_state.config.batch_expr = optarg;
+                app_state.config.batch_expr_syntax = EXPR_SYNTAX_RPN;
+                break;
+            case 'o':
+                app_state.config.batch_output_path = optarg;
+                break;
+            case 'O':
+                if (strcmp(optarg, "mmap") == 0) {
+                    app_state.config.batch_use_mmap = true;
+                } else if (strcmp(optarg, "read") == 0) {
+                    app_state.config.batch_use_mmap = false;
+                } else {
+                    TRACE("Unknown batch io: %s\n", optarg);
+                    return false;
+                }
+                break;
+            case 'f':
+                if (strcmp(optarg, "text") == 0) {
+                    app_state.config.batch_output_format = BATCH_FORMAT_TEXT;
+                } else if (strcmp(optarg, "columnar") == 0) {
+                    app_state.config.batch_output_format = BATCH_FORMAT_COLUMNAR;
+                } else {
+                    TRACE("Unknown batch format: %s\n", optarg);
+                    return false;
+                }
+                break;
+            case 'c':
+                app_state.config.batch_convert_path = optarg;
+                break;
+            case 'k':
+                if (strcmp(optarg, "dec") == 0) {
+                    app_state.config.batch_radix = 10;
+                } else if (strcmp(optarg, "hex") == 0) {
+                    app_state.config.batch_radix = 16;
+                } else if (strcmp(optarg, "bin") == 0) {
+                    app_state.config.batch_radix = 2;
+                } else {
+                    TRACE("Unknown batch radix: %s\n", optarg);
+                    return false;
+                }
+                break;
+            case 'T':
+                number = WorkPoolDefaultWorkers();
+                if (optarg != NULL && !ParseNumberArgument("thread count", optarg, &number)) {
+                    return false;
+                }
+                if (number == 0 || number > WORK_POOL_MAX_WORKERS) {
+                    TRACE("Thread count must be in range [1, %d]\n", WORK_POOL_MAX_WORKERS);
+                    return false;
+                }
+                app_state.config.batch_threads = number;
+                break;
+            case 'R':
+                number = RPN_DEFAULT_DEPTH;
+                if (optarg != NULL && !ParseNumberArgument("RPN stack depth", optarg, &number)) {
+                    return false;
+                }
+                if (number < 2 || number > RPN_MAX_DEPTH) {
+                    TRACE("RPN stack depth must be in range [2, %d]\n", RPN_MAX_DEPTH);
+                    return false;
+                }
+                app_state.config.rpn_depth = number;
+                break;
+            case 'M':
+                app_state.config.macro_mode = true;
+                break;
+            case 'I':
+                number = IDLE_DEFAULT_TIMEOUT_S;
+                if (optarg != NULL && !ParseNumberArgument("idle timeout", optarg, &number)) {
+                    return false;
+                }
+                if (number == 0 || number > INT_MAX / 1000) {
+                    TRACE("Idle timeout must be in range [1, %d] s\n", INT_MAX / 1000);
+                    return false;
+                }
+                app_state.config.idle_timeout_ms = (int) number * 1000;
+                break;
+            case 'p':
+                for (char *path = strtok(optarg, ","); path != NULL; path = strtok(NULL, ",")) {
+                    if (app_state.config.num_panels == PANELS_MAX_PANELS) {
+                        TRACE("At most %d panels are supported\n", PANELS_MAX_PANELS);
+                        return false;
+                    }
+                    app_state.config.panel_paths[app_state.config.num_panels++] = path;
+                }
+                break;
+            case 'S':
+                if (!ParseNumberArgument("shard count", optarg, &number)) {
+                    return false;
+                }
+                if (number == 0 || number > PANELS_MAX_SHARDS) {
+                    TRACE("Shard count must be in range [1, %d]\n", PANELS_MAX_SHARDS);
+                    return false;
+                }
+                app_state.config.num_shards = number;
+                break;
+            case 'H':
+                app_state.config.handoff_path = optarg;
+                break;
+            case 'w':
+                app_state.config.snapshot_path = optarg;
+                break;
+            case 'P':
+                if (optarg == NULL || strcmp(optarg, "add") == 0) {
+                    app_state.config.preview_op = ADDITION;
+                } else if (strcmp(optarg, "sub") == 0) {
+                    app_state.config.preview_op = SUBTRACTION;
+                } else if (strcmp(optarg, "mul") == 0) {
+                    app_state.config.preview_op = MULTIPLICATION;
+                } else {
+                    TRACE("Unknown preview operation: %s\n", optarg);
+                    return false;
+                }
+                break;
+            case 'i':
+                if (strcmp(optarg, "binary") == 0) {
+                    app_state.config.entry_mode = ENTRY_MODE_BINARY;
+                } else if (strcmp(optarg, "decimal") == 0) {
+                    app_state.config.entry_mode = ENTRY_MODE_DECIMAL;
+                } else {
+                    TRACE("Unknown entry mode: %s\n", optarg);
+                    return false;
+                }
+                break;
+            case 'h':
+            default:
+                return false;
+        }
+    }
+
+    if (app_state.config.macro_mode && app_state.config.rpn_depth > 0) {
+        TRACE("Macro and RPN modes are mutually exclusive\n");
+        return false;
+    }
+
+    if (app_state.config.handoff_path != NULL &&
+        (app_state.config.gpiomem_path != NULL || app_state.io.backend != GPIO_BACKEND_CDEV)) {
+        TRACE("Handoff passes cdev line requests, it can't be used with other backends\n");
+        return false;
+    }
+
+    if (app_state.config.preview_op != LAST_OPERATION &&
+        (CalcIsRealMode(app_state.config.calc_mode) || app_state.config.macro_mode ||
+         app_state.config.rpn_depth > 0)) {
+        TRACE("Preview needs integer mode without macro or RPN entry\n");
+        return false;
+    }
+
+    return true;
+}
+
+void PrintUsage(const char *program) {
+    printf("Usage: %s [options]\n"
+        "  -b, --backend=cdev|periphery  GPIO backend, cdev falls back to c-periphery when unforced (default: cdev)\n"
+        "      --bench-gpio[=N]          benchmark LED writes of all backends with N iterations and exit\n"
+        "      --gpiomem[=PATH]          drive leds through mapped registers (default: %s),\n"
+        "                                regular file is used as fake register page\n"
+        "  -d, --display=MODE            result display mode (default: binary):\n"
+        "                                binary - one bit per frame\n"
+        "                                pwm - one base-N digit per led as its brightness\n"
+        "                                rle - runs of equal bits as blinking count frame followed by bit frame\n"
+        "                                decimal - one BCD digit per frame, most significant first,\n"
+        "                                0 is shown as all leds lit\n"
+        "                                delta - only nibbles differing from the previous result, each after\n"
+        "                                its blinking index, index or nibble 0 blinks all leds fast; single\n"
+        "                                flash when nothing changed; signed modes start with sign frame\n"
+        "  -l, --pwm-levels=N            brightness levels per led in pwm mode, 2-4 (default: %d)\n"
+        "  -e, --encoding=plain|min-toggle\n"
+        "                                min-toggle shows operations in gray code and result bits on leds 1-2\n"
+        "                                with gray coded frame counter on leds 3-4 (default: plain)\n"
+        "  -i, --entry=binary|decimal    operand entry, decimal builds number digit by digit, picking each\n"
+        "                                from a window of three in 2-3 presses (default: binary)\n"
+        "  -s, --signed                  signed two's complement operands and results, sign is entered with\n"
+        "                                remove button on empty argument and shown as separate frame\n"
+        "      --fixed[=FRAC]            signed fixed point with FRAC fraction bits, 0-%d (default: %d),\n"
+        "                                operands are entered as mantissa and decimal exponent, result is shown\n"
+        "                                as sign, integer nibbles, separator flash and fraction nibbles\n"
+        "      --float                   IEEE-754 double, entered as fixed point, result is shown as 3 exponent\n"
+        "                                nibbles, sign and mantissa nibbles\n"
+        "      --modulus=M               unsigned arithmetic modulo M, division is replaced by exponentiation,\n"
+        "                                odd M uses Montgomery multiplication, even M Barrett reduction\n"
+        "      --batch[=FILE]            evaluate \"a op b\" lines of FILE (default: stdin) to stdout and exit\n"
+        "      --bench-batch             print batch parse, evaluate and format timings to stderr\n"
+        "      --expr=EXPR               batch lines hold values of variables a, b, c, ... of infix EXPR,\n"
+        "                                e.g. \"(a - 32) * 5 / 9\", compiled once and evaluated per line\n"
+        "      --rpn-expr=EXPR           same as --expr with EXPR in RPN, ~ negates, e.g. \"a 32 - 5 * 9 /\"\n"
+        "      --batch-output=FILE       write batch results to FILE instead of stdout\n"
+        "      --batch-io=mmap|read      regular batch files are mapped and parsed in place, output file is written\n"
+        "                                through bounded mapped windows, read copies through buffers (default: mmap)\n"
+        "      --threads[=N]             evaluate batch on N worker threads (default: all cpus), output order\n"
+        "                                follows input order; input is held whole, results are written as\n"
+        "                                they come, so malformed line leaves results of preceding lines\n"
+        "                                written, while serial run writes none\n"
+        "      --batch-format=text|columnar\n"
+        "                                format of batch results, columnar writes binary value and flag arrays\n"
+        "                                into --batch-output file (default: text); input in columnar format\n"
+        "                                is recognized by its header\n"
+        "      --convert=FILE            convert text \"a op b\" batch into columnar jobs FILE and exit\n"
+        "      --batch-radix=dec|hex|bin dec prints text results in the number mode, hex and bin print raw\n"
+        "                                bit patterns with 0x/0b prefix, which integer modes also accept\n"
+        "                                as input (default: dec)\n"
+        "      --rpn[=DEPTH]             reverse polish entry on operand stack of DEPTH, 2-%d (default: %d),\n"
+        "                                operations replace two topmost operands without displaying anything\n"
+        "      --macro                   first operand is followed by macro commands: record operation and constant\n"
+        "                                operand steps, or replay recorded steps with single press\n"
+        "      --idle-timeout[=SEC]      blank leds after SEC without button edge (default: %d), then wait\n"
+        "                                for edges with no periodic wakeup; first edge restores the leds\n"
+        "      --preview[=add|sub|mul]   integer modes - button 1 during second operand entry shows low nibble\n"
+        "                                of the result so far, second press proceeds (default: add)\n"
+        "      --panels=CHIP[,CHIP...]   serve button/led panel on every listed gpio chip and exit on Ctrl+C,\n"
+        "                                presses toggle led of the same index; panels are measured for %d ms\n"
+        "                                on single loop, then spread over per-cpu loops by event rate\n"
+        "      --shards=N                event loop threads serving panels, 1-%d (default: all cpus)\n"
+        "      --handoff=PATH            hand buttons, leds and calculator state to the next binary started\n"
+        "                                with the same PATH without releasing the lines; when a process\n"
+        "                                already listens there, its lines and state are taken over instead\n"
+        "      --snapshot=FILE           keep calculator state in mapped FILE, updated after every button,\n"
+        "                                and resume from it on start, e.g. after crash\n"
+        "  -r, --browse                  page through result nibble by nibble instead of sequential playback\n"
+        "  -h, --help                    show this help\n", program, GPIO_MMAP_DEV_PATH, PWM_DEFAULT_LEVELS,
+           CALC_MAX_FRAC_BITS, CALC_DEFAULT_FRAC_BITS, RPN_MAX_DEPTH, RPN_DEFAULT_DEPTH, IDLE_DEFAULT_TIMEOUT_S,
+           PANELS_DEFAULT_CALIBRATION_MS, PANELS_MAX_SHARDS);
+}
+
+// ------------------------------
+// Benchmark functions
+// ------------------------------
+
+static double ElapsedNs(const struct timespec *start, const struct timespec *end) {
+    return (double) (end->tv_sec - start->tv_sec) * 1e9 + (double) (end->tv_nsec - start->tv_nsec);
+}
+
+void BenchmarkGpioBackends(const size_t iterations) {
+    static const char *kBackendNames[LAST_GPIO_BACKEND] = {"cdev v2", "c-periphery", "mmap"};
+
+    app_state.config.force_backend = true;
+
+    for (gpio_backend_t backend = GPIO_BACKEND_CDEV; backend < LAST_GPIO_BACKEND; backend++) {
+        app_state.io.backend = backend;
+        app_state.io.led_backend = backend;
 
-    SetLedState(0, (bits & 0b1000) > 0);
-    SetLedState(1, (bits & 0b0100) > 0);
-    SetLedState(2, (bits & 0b0010) > 0);
-    SetLedState(3, (bits & 0b0001) > 0);
+        bool initialized = true;
+        switch (backend) {
+            case GPIO_BACKEND_CDEV:
+                initialized = InitializeCdevLeds();
+                break;
+            case GPIO_BACKEND_MMAP:
+                initialized = app_state.config.gpiomem_path != NULL && InitializeMmapLeds();
+                break;
+            case GPIO_BACKEND_PERIPHERY:
+            case LAST_GPIO_BACKEND:
+                initialized = InitializePeripheryLeds();
+                break;
+        }
+
+        if (!initialized) {
+            TRACE("[%s] unavailable, skipping\n", kBackendNames[backend]);
+            continue;
+        }
+
+        struct timespec start, end;
+
+        /* whole bank in single call */
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (size_t i = 0; i < iterations; i++) {
+            SetLedBank(i & 0b1111);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        const double bank_ns = ElapsedNs(&start, &end) / (double) iterations;
+
+        /* single line toggling */
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (size_t i = 0; i < iterations; i++) {
+            SetLedState(i % NUM_LEDS, (int) (i & 1));
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        const double line_ns = ElapsedNs(&start, &end) / (double) iterations;
+
+        /* level read back */
+        uint64_t read_bits = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (size_t i = 0; i < iterations; i++) {
+            read_bits ^= GetLedBank();
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        const double read_ns = ElapsedNs(&start, &end) / (double) iterations;
+
+        DisableAllLeds();
+        CleanupLeds();
+
+        TRACE("[%s] bank write: %.1f ns, single led write: %.1f ns, bank read: %.1f ns (%lu)\n",
+              kBackendNames[backend], bank_ns, line_ns, read_ns, read_bits);
+    }
 }
 
 // ------------------------------
 // Entry point
 // ------------------------------
 
-int main(void) {
+int main(int argc, char *argv[]) {
+    if (!ParseArguments(argc, argv)) {
+        PrintUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (app_state.config.bench_gpio_iterations > 0) {
+        BenchmarkGpioBackends(app_state.config.bench_gpio_iterations);
+        return 0;
+    }
+
+    if (app_state.config.batch_path != NULL || app_state.config.bench_batch || app_state.config.batch_expr != NULL ||
+        app_state.config.batch_convert_path != NULL) {
+        const batch_options_t options = {
+            .mode = app_state.config.calc_mode,
+            .bench = app_state.config.bench_batch,
+            .expr = app_state.config.batch_expr,
+            .expr_syntax = app_state.config.batch_expr_syntax,
+            .num_threads = app_state.config.batch_threads,
+            .use_mmap = app_state.config.batch_use_mmap,
+            .output_format = app_state.config.batch_output_format,
+            .convert_path = app_state.config.batch_convert_path,
+            .radix = app_state.config.batch_radix,
+        };
+        const char *path = app_state.config.batch_path != NULL ? app_state.config.batch_path : BATCH_STDIO_PATH;
+
+        return BatchRun(&options, path, app_state.config.batch_output_path) < 0 ? EXIT_FAILURE : 0;
+    }
+
+    if (app_state.config.num_panels > 0) {
+        const size_t num_shards = app_state.config.num_shards > 0 ? app_state.config.num_shards
+                                                                  : WorkPoolDefaultWorkers();
+        const panels_options_t options = {
+            .chip_paths = app_state.config.panel_paths,
+            .num_panels = app_state.config.num_panels,
+            .num_shards = num_shards < PANELS_MAX_SHARDS ? num_shards : PANELS_MAX_SHARDS,
+            .button_offsets = kButtonPins,
+            .num_buttons = NUM_BUTTONS,
+            .led_offsets = kLedPins,
+            .num_leds = NUM_LEDS,
+            .debounce_us = KERNEL_DEBOUNCE_US,
+            .calibration_ms = PANELS_DEFAULT_CALIBRATION_MS,
+        };
+
+        return PanelsRun(&options) < 0 ? EXIT_FAILURE : 0;
+    }
+
     TRACE("Welcome to binary calculator project for linsw - lab2!\n");
-    InitializeButtons();
-    InitializeLeds();
-    EnableAllLeds();
+    const bool taken_over = app_state.config.handoff_path != NULL && TakeOver();
+
+    if (!taken_over) {
+        InitializeButtons();
+        InitializeLeds();
+        EnableAllLeds();
+    }
+
+    if (app_state.config.snapshot_path != NULL) {
+        InitializeSnapshot(!taken_over);
+    }
+
+    if (app_state.config.handoff_path != NULL) {
+        StartHandoff();
+    }
+
     RunStateMachine();
     TRACE("Goodbye, that was a good time...\n");
 
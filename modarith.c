@@ -0,0 +1,65 @@
+#include "modarith.h"
+
+// ------------------------------
+// Function implementations
+// ------------------------------
+
+bool ModInit(mod_context_t *ctx, const uint64_t modulus) {
+    if (modulus == 0) {
+        return false;
+    }
+
+    ctx->modulus = modulus;
+    ctx->montgomery = (modulus & 1) != 0;
+    ctx->mu = ~(unsigned __int128) 0 / modulus;
+
+    if (ctx->montgomery) {
+        /* Newton iteration doubles correct low bits each step, odd modulus is its own inverse mod 8 */
+        uint64_t inv = modulus;
+        for (int i = 0; i < 5; i++) {
+            inv *= 2 - modulus * inv;
+        }
+
+        ctx->inv = inv;
+        ctx->r1 = (uint64_t) (((unsigned __int128) 1 << 64) % modulus);
+        ctx->r2 = (uint64_t) ((unsigned __int128) ctx->r1 * ctx->r1 % modulus);
+    } else {
+        ctx->inv = 0;
+        ctx->r1 = 0;
+        ctx->r2 = 0;
+    }
+
+    return true;
+}
+
+uint64_t ModExp(const mod_context_t *ctx, const uint64_t base, uint64_t exponent) {
+    if (!ctx->montgomery) {
+        uint64_t result = ModReduce(ctx, 1);
+        uint64_t square = ModReduce(ctx, base);
+
+        while (exponent != 0) {
+            /* multiply unconditionally and select, exponent bits are unpredictable */
+            const uint64_t product = ModBarrett(ctx, (unsigned __int128) result * square);
+            result = exponent & 1 ? product : result;
+
+            square = ModBarrett(ctx, (unsigned __int128) square * square);
+            exponent >>= 1;
+        }
+
+        return result;
+    }
+
+    /* everything stays in Montgomery form until the final reduction */
+    uint64_t result = ctx->r1;
+    uint64_t square = ModRedc(ctx, (unsigned __int128) ModReduce(ctx, base) * ctx->r2);
+
+    while (exponent != 0) {
+        const uint64_t product = ModRedc(ctx, (unsigned __int128) result * square);
+        result = exponent & 1 ? product : result;
+
+        square = ModRedc(ctx, (unsigned __int128) square * square);
+        exponent >>= 1;
+    }
+
+    return ModRedc(ctx, result);
+}
@@ -0,0 +1,113 @@
+#ifndef MODARITH_H
+#define MODARITH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Arithmetic modulo fixed 64-bit modulus. Constants depending on the modulus are computed once
+ * by ModInit and reused by every operation, so that no operation needs hardware division:
+ * odd moduli use Montgomery multiplication (R = 2^64), even ones Barrett reduction of the
+ * 128-bit product. Operands may be any 64-bit values, results are always in [0, modulus).
+ */
+typedef struct ModContext {
+    uint64_t modulus;
+    bool montgomery;
+
+    /* Montgomery: modulus^-1 mod 2^64, R mod modulus and R^2 mod modulus */
+    uint64_t inv;
+    uint64_t r1;
+    uint64_t r2;
+
+    /* Barrett: floor((2^128 - 1) / modulus) */
+    unsigned __int128 mu;
+} mod_context_t;
+
+// ------------------------------
+// Inline implementations
+// ------------------------------
+
+/* t * R^-1 mod modulus for t < modulus * 2^64 */
+static inline uint64_t ModRedc(const mod_context_t *ctx, const unsigned __int128 t) {
+    /* low half of u * modulus equals low half of t, so only high halves need to be subtracted */
+    const uint64_t u = (uint64_t) t * ctx->inv;
+    const uint64_t um_hi = (uint64_t) (((unsigned __int128) u * ctx->modulus) >> 64);
+
+    /* both halves are below modulus, borrow is a coin flip - fix it up with mask instead of branch */
+    uint64_t diff;
+    const bool borrow = __builtin_sub_overflow((uint64_t) (t >> 64), um_hi, &diff);
+
+    return diff + (ctx->modulus & ((uint64_t) 0 - (uint64_t) borrow));
+}
+
+/* x mod modulus for any 128-bit x */
+static inline uint64_t ModBarrett(const mod_context_t *ctx, const unsigned __int128 x) {
+    const uint64_t x_lo = (uint64_t) x;
+    const uint64_t x_hi = (uint64_t) (x >> 64);
+    const uint64_t mu_lo = (uint64_t) ctx->mu;
+    const uint64_t mu_hi = (uint64_t) (ctx->mu >> 64);
+
+    /* q = high 128 bits of x * mu, estimate is at most 2 below floor(x / modulus) */
+    const unsigned __int128 lo_lo = (unsigned __int128) x_lo * mu_lo;
+    const unsigned __int128 lo_hi = (unsigned __int128) x_lo * mu_hi;
+    const unsigned __int128 hi_lo = (unsigned __int128) x_hi * mu_lo;
+    const unsigned __int128 hi_hi = (unsigned __int128) x_hi * mu_hi;
+
+    const unsigned __int128 mid = (lo_lo >> 64) + (uint64_t) lo_hi + (uint64_t) hi_lo;
+    const unsigned __int128 q = hi_hi + (lo_hi >> 64) + (hi_lo >> 64) + (mid >> 64);
+
+    /* two masked corrections instead of loop, remainder estimate is below 3 * modulus */
+    unsigned __int128 r = x - q * ctx->modulus;
+    r -= ctx->modulus & ((unsigned __int128) 0 - (r >= ctx->modulus));
+    r -= ctx->modulus & ((unsigned __int128) 0 - (r >= ctx->modulus));
+
+    return (uint64_t) r;
+}
+
+static inline uint64_t ModReduce(const mod_context_t *ctx, const uint64_t a) {
+    /* operands are usually reduced already, skip the reduction then */
+    if (a < ctx->modulus) {
+        return a;
+    }
+
+    return ctx->montgomery ? ModRedc(ctx, (unsigned __int128) ModRedc(ctx, a) * ctx->r2)
+                           : ModBarrett(ctx, a);
+}
+
+static inline uint64_t ModAdd(const mod_context_t *ctx, uint64_t a, uint64_t b) {
+    a = ModReduce(ctx, a);
+    b = ModReduce(ctx, b);
+
+    /* sum below 2 * modulus, wrap of 64-bit sum means it is above modulus as well */
+    const uint64_t sum = a + b;
+    return (sum < a) | (sum >= ctx->modulus) ? sum - ctx->modulus : sum;
+}
+
+static inline uint64_t ModSub(const mod_context_t *ctx, uint64_t a, uint64_t b) {
+    a = ModReduce(ctx, a);
+    b = ModReduce(ctx, b);
+
+    return a >= b ? a - b : a - b + ctx->modulus;
+}
+
+static inline uint64_t ModMul(const mod_context_t *ctx, const uint64_t a, const uint64_t b) {
+    if (!ctx->montgomery) {
+        return ModBarrett(ctx, (unsigned __int128) a * b);
+    }
+
+    /* (a * R) * b * R^-1 = a * b, first reduction also brings a into Montgomery form */
+    const uint64_t a_mont = ModRedc(ctx, (unsigned __int128) ModReduce(ctx, a) * ctx->r2);
+    return ModRedc(ctx, (unsigned __int128) a_mont * ModReduce(ctx, b));
+}
+
+// ------------------------------
+// Function definitions
+// ------------------------------
+
+/* Precomputes constants of the modulus, returns false for modulus 0 */
+bool ModInit(mod_context_t *ctx, uint64_t modulus);
+
+/* base^exponent mod modulus, square and multiply over Montgomery form for odd moduli */
+uint64_t ModExp(const mod_context_t *ctx, uint64_t base, uint64_t exponent);
+
+#endif // MODARITH_H
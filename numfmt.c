@@ -0,0 +1,430 @@
+#include "numfmt.h"
+
+#include <string.h>
+
+// ------------------------------
+// Static data
+// ------------------------------
+
+static const char kDigitPairs[200] =
+        "00010203040506070809"
+        "10111213141516171819"
+        "20212223242526272829"
+        "30313233343536373839"
+        "40414243444546474849"
+        "50515253545556575859"
+        "60616263646566676869"
+        "70717273747576777879"
+        "80818283848586878889"
+        "90919293949596979899";
+
+static const char kHexDigits[16] = "0123456789abcdef";
+
+static const uint64_t kPowersOf10[NUMFMT_U64_MAX_DECIMAL_DIGITS] = {
+    1ULL,
+    10ULL,
+    100ULL,
+    1000ULL,
+    10000ULL,
+    100000ULL,
+    1000000ULL,
+    10000000ULL,
+    100000000ULL,
+    1000000000ULL,
+    10000000000ULL,
+    100000000000ULL,
+    1000000000000ULL,
+    10000000000000ULL,
+    100000000000000ULL,
+    1000000000000000ULL,
+    10000000000000000ULL,
+    100000000000000000ULL,
+    1000000000000000000ULL,
+    10000000000000000000ULL,
+};
+
+#define CHUNK_DIGITS 8
+#define CHUNK_DIVISOR 100000000U
+#define U128_SPLIT_DIGITS 19
+#define U128_SPLIT_DIVISOR 10000000000000000000ULL
+#define SWAR_DIGITS 8
+#define SWAR_DIVISOR 100000000ULL
+
+// ------------------------------
+// Static helpers
+// ------------------------------
+
+/* x / 100 for any 32-bit x, single multiplication */
+static inline uint32_t DivBy100(const uint32_t x) {
+    return (uint32_t) (((uint64_t) x * 1374389535ULL) >> 37);
+}
+
+static inline void WritePair(char *out, const uint32_t pair) {
+    memcpy(out, &kDigitPairs[pair * 2], 2);
+}
+
+/* writes exactly 8 digits ending right before end, returns start of written digits */
+static char *WriteChunkPadded(char *end, uint32_t value) {
+    for (size_t i = 0; i < CHUNK_DIGITS / 2; i++) {
+        const uint32_t q = DivBy100(value);
+        end -= 2;
+        WritePair(end, value - q * 100);
+        value = q;
+    }
+
+    return end;
+}
+
+/* writes digits of value < 10^8 without leading zeros, ending right before end */
+static char *WriteChunk(char *end, uint32_t value) {
+    while (value >= 100) {
+        const uint32_t q = DivBy100(value);
+        end -= 2;
+        WritePair(end, value - q * 100);
+        value = q;
+    }
+
+    if (value >= 10) {
+        end -= 2;
+        WritePair(end, value);
+    } else {
+        *--end = (char) ('0' + value);
+    }
+
+    return end;
+}
+
+/* writes all digits of value, zero padded to at least min_digits, ending right before end */
+static char *WriteU64(char *end, uint64_t value, size_t min_digits) {
+    while (value >= CHUNK_DIVISOR || min_digits > CHUNK_DIGITS) {
+        /* constant divisor - compiled to multiplication and shift */
+        const uint64_t q = value / CHUNK_DIVISOR;
+        end = WriteChunkPadded(end, (uint32_t) (value - q * CHUNK_DIVISOR));
+        value = q;
+        min_digits = min_digits > CHUNK_DIGITS ? min_digits - CHUNK_DIGITS : 0;
+    }
+
+    char *start = WriteChunk(end, (uint32_t) value);
+    while ((size_t) (end - start) < min_digits) {
+        *--start = '0';
+    }
+
+    return start;
+}
+
+static size_t HexLength(const uint64_t value) {
+    return (size_t) (67 - __builtin_clzll(value | 1)) / 4;
+}
+
+static size_t BinaryLength(const uint64_t value) {
+    return (size_t) (64 - __builtin_clzll(value | 1));
+}
+
+/* writes low len hex digits of value, zero padded, two digits per input byte */
+static void WriteHexPadded(char *out, uint64_t value, const size_t len) {
+    char *end = out + len;
+
+    for (size_t i = 0; i < len / 2; i++) {
+        end -= 2;
+        end[0] = kHexDigits[(value >> 4) & 0xf];
+        end[1] = kHexDigits[value & 0xf];
+        value >>= 8;
+    }
+
+    if (len & 1) {
+        *--end = kHexDigits[value & 0xf];
+    }
+}
+
+/* writes 8 binary digits of byte, most significant first */
+static inline void WriteBinaryByte(char *out, const uint8_t byte) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    /* byte k of the product keeps bit 7 - k in place, adding 0x80 - that bit carries it into bit 7 */
+    const uint64_t bits = ((byte * 0x0101010101010101ULL) & 0x0102040810204080ULL) + 0x7f7e7c7870604000ULL;
+    const uint64_t digits = ((bits >> 7) & 0x0101010101010101ULL) | 0x3030303030303030ULL;
+    memcpy(out, &digits, sizeof(digits));
+#else
+    for (size_t i = 0; i < 8; i++) {
+        out[i] = (char) ('0' + ((byte >> (7 - i)) & 1));
+    }
+#endif
+}
+
+/* writes low len binary digits of value, zero padded */
+static void WriteBinaryPadded(char *out, uint64_t value, const size_t len) {
+    char *end = out + len;
+
+    for (size_t i = 0; i < len / 8; i++) {
+        end -= 8;
+        WriteBinaryByte(end, (uint8_t) value);
+        value >>= 8;
+    }
+
+    const size_t rest = len % 8;
+    if (rest > 0) {
+        char digits[8];
+        WriteBinaryByte(digits, (uint8_t) value);
+        memcpy(out, digits + 8 - rest, rest);
+    }
+}
+
+/* value of digit in any supported radix, 16 or more for anything else */
+static inline unsigned DigitValue(const char c) {
+    if (c >= '0' && c <= '9') {
+        return (unsigned) (c - '0');
+    }
+
+    const unsigned lower = (unsigned char) c | 0x20;
+    return lower >= 'a' && lower <= 'f' ? lower - 'a' + 10 : 16;
+}
+
+/* value of exactly 8 decimal digits */
+static inline uint32_t ParseEightDigits(const char *str) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    /* first digit is the lowest byte, combine neighbours into pairs, quads and the whole chunk */
+    uint64_t chunk;
+    memcpy(&chunk, str, sizeof(chunk));
+    chunk -= 0x3030303030303030ULL;
+    chunk = (chunk * 10 + (chunk >> 8)) & 0x00ff00ff00ff00ffULL;
+    chunk = (chunk * 100 + (chunk >> 16)) & 0x0000ffff0000ffffULL;
+    return (uint32_t) ((chunk * 10000 + (chunk >> 32)) & 0xffffffffULL);
+#else
+    uint32_t value = 0;
+    for (size_t i = 0; i < SWAR_DIGITS; i++) {
+        value = value * 10 + (uint32_t) (str[i] - '0');
+    }
+    return value;
+#endif
+}
+
+/* value of len <= 19 decimal digits, which always fits */
+static uint64_t ParseDecimalRun(const char *str, size_t len) {
+    uint64_t value = 0;
+
+    for (; len >= SWAR_DIGITS; len -= SWAR_DIGITS, str += SWAR_DIGITS) {
+        value = value * SWAR_DIVISOR + ParseEightDigits(str);
+    }
+
+    for (; len > 0; len--, str++) {
+        value = value * 10 + (uint64_t) (*str - '0');
+    }
+
+    return value;
+}
+
+/* finds run of decimal digits, sets its start past leading zeros, returns its end */
+static const char *ScanDecimal(const char *str, const char **significant) {
+    const char *end = str;
+    while (*end >= '0' && *end <= '9') {
+        end++;
+    }
+
+    const char *start = str;
+    while (start + 1 < end && *start == '0') {
+        start++;
+    }
+
+    *significant = start;
+    return end;
+}
+
+// ------------------------------
+// Function implementations
+// ------------------------------
+
+size_t NumFmtU64DecimalLength(const uint64_t value) {
+    /* log10 estimate from bit length, 1233 / 4096 ~ log10(2), corrected by single comparison */
+    const uint64_t v = value | 1;
+    const size_t bits = (size_t) (64 - __builtin_clzll(v));
+    const size_t estimate = (bits * 1233) >> 12;
+
+    return estimate + (v >= kPowersOf10[estimate]);
+}
+
+size_t NumFmtU64ToDecimal(const uint64_t value, char *out) {
+    const size_t len = NumFmtU64DecimalLength(value);
+
+    out[len] = '\0';
+    WriteU64(out + len, value, 0);
+
+    return len;
+}
+
+size_t NumFmtU128ToDecimal(const unsigned __int128 value, char *out) {
+    if (value <= UINT64_MAX) {
+        return NumFmtU64ToDecimal((uint64_t) value, out);
+    }
+
+    /* split into at most three 64-bit parts of 19 digits each */
+    const unsigned __int128 hi_mid = value / U128_SPLIT_DIVISOR;
+    const uint64_t lo = (uint64_t) (value - hi_mid * U128_SPLIT_DIVISOR);
+
+    char tmp[NUMFMT_U128_MAX_DECIMAL_DIGITS];
+    char *end = tmp + sizeof(tmp);
+
+    end = WriteU64(end, lo, U128_SPLIT_DIGITS);
+
+    if (hi_mid <= UINT64_MAX) {
+        end = WriteU64(end, (uint64_t) hi_mid, 0);
+    } else {
+        const uint64_t hi = (uint64_t) (hi_mid / U128_SPLIT_DIVISOR);
+        const uint64_t mid = (uint64_t) (hi_mid - (unsigned __int128) hi * U128_SPLIT_DIVISOR);
+
+        end = WriteU64(end, mid, U128_SPLIT_DIGITS);
+        end = WriteU64(end, hi, 0);
+    }
+
+    const size_t len = (size_t) (tmp + sizeof(tmp) - end);
+    memcpy(out, end, len);
+    out[len] = '\0';
+
+    return len;
+}
+
+size_t NumFmtU64ToHex(const uint64_t value, char *out) {
+    const size_t len = HexLength(value);
+
+    WriteHexPadded(out, value, len);
+    out[len] = '\0';
+
+    return len;
+}
+
+size_t NumFmtU128ToHex(const unsigned __int128 value, char *out) {
+    const uint64_t hi = (uint64_t) (value >> 64);
+
+    if (hi == 0) {
+        return NumFmtU64ToHex((uint64_t) value, out);
+    }
+
+    const size_t hi_len = HexLength(hi);
+    WriteHexPadded(out, hi, hi_len);
+    WriteHexPadded(out + hi_len, (uint64_t) value, NUMFMT_U64_MAX_HEX_DIGITS);
+    out[hi_len + NUMFMT_U64_MAX_HEX_DIGITS] = '\0';
+
+    return hi_len + NUMFMT_U64_MAX_HEX_DIGITS;
+}
+
+size_t NumFmtU64ToBinary(const uint64_t value, char *out) {
+    const size_t len = BinaryLength(value);
+
+    WriteBinaryPadded(out, value, len);
+    out[len] = '\0';
+
+    return len;
+}
+
+size_t NumFmtU128ToBinary(const unsigned __int128 value, char *out) {
+    const uint64_t hi = (uint64_t) (value >> 64);
+
+    if (hi == 0) {
+        return NumFmtU64ToBinary((uint64_t) value, out);
+    }
+
+    const size_t hi_len = BinaryLength(hi);
+    WriteBinaryPadded(out, hi, hi_len);
+    WriteBinaryPadded(out + hi_len, (uint64_t) value, NUMFMT_U64_MAX_BINARY_DIGITS);
+    out[hi_len + NUMFMT_U64_MAX_BINARY_DIGITS] = '\0';
+
+    return hi_len + NUMFMT_U64_MAX_BINARY_DIGITS;
+}
+
+const char *NumFmtParseU64(const char *str, const unsigned radix, uint64_t *value) {
+    if (radix == 10) {
+        const char *digits;
+        const char *end = ScanDecimal(str, &digits);
+        const size_t len = (size_t) (end - digits);
+
+        if (end == str || len > NUMFMT_U64_MAX_DECIMAL_DIGITS) {
+            return NULL;
+        }
+
+        if (len < NUMFMT_U64_MAX_DECIMAL_DIGITS) {
+            *value = ParseDecimalRun(digits, len);
+            return end;
+        }
+
+        /* only the 20th digit can overflow */
+        const uint64_t head = ParseDecimalRun(digits, len - 1);
+        if (__builtin_mul_overflow(head, 10, value) ||
+            __builtin_add_overflow(*value, (uint64_t) (digits[len - 1] - '0'), value)) {
+            return NULL;
+        }
+
+        return end;
+    }
+
+    if (radix != 16 && radix != 2) {
+        return NULL;
+    }
+
+    /* every digit shifts in fixed number of bits, overflow is any bit pushed out of the top */
+    const unsigned digit_bits = radix == 16 ? 4 : 1;
+    const char *cur = str;
+    uint64_t result = 0;
+
+    for (unsigned digit; (digit = DigitValue(*cur)) < radix; cur++) {
+        if (result >> (64 - digit_bits) != 0) {
+            return NULL;
+        }
+
+        result = (result << digit_bits) | digit;
+    }
+
+    if (cur == str) {
+        return NULL;
+    }
+
+    *value = result;
+    return cur;
+}
+
+const char *NumFmtParseU128(const char *str, const unsigned radix, unsigned __int128 *value) {
+    if (radix == 10) {
+        const char *digits;
+        const char *end = ScanDecimal(str, &digits);
+        size_t len = (size_t) (end - digits);
+
+        if (end == str || len > NUMFMT_U128_MAX_DECIMAL_DIGITS) {
+            return NULL;
+        }
+
+        /* leading part is shorter, the rest comes in 19 digit parts that fit 64 bits */
+        const size_t head_len = len % U128_SPLIT_DIGITS ? len % U128_SPLIT_DIGITS : U128_SPLIT_DIGITS;
+        unsigned __int128 result = ParseDecimalRun(digits, head_len);
+
+        for (digits += head_len, len -= head_len; len > 0; digits += U128_SPLIT_DIGITS, len -= U128_SPLIT_DIGITS) {
+            if (__builtin_mul_overflow(result, (unsigned __int128) U128_SPLIT_DIVISOR, &result) ||
+                __builtin_add_overflow(result, (unsigned __int128) ParseDecimalRun(digits, U128_SPLIT_DIGITS),
+                                       &result)) {
+                return NULL;
+            }
+        }
+
+        *value = result;
+        return end;
+    }
+
+    if (radix != 16 && radix != 2) {
+        return NULL;
+    }
+
+    const unsigned digit_bits = radix == 16 ? 4 : 1;
+    const char *cur = str;
+    unsigned __int128 result = 0;
+
+    for (unsigned digit; (digit = DigitValue(*cur)) < radix; cur++) {
+        if (result >> (128 - digit_bits) != 0) {
+            return NULL;
+        }
+
+        result = (result << digit_bits) | digit;
+    }
+
+    if (cur == str) {
+        return NULL;
+    }
+
+    *value = result;
+    return cur;
+}
@@ -0,0 +1,58 @@
+#ifndef NUMFMT_H
+#define NUMFMT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// ------------------------------
+// defines
+// ------------------------------
+
+#define NUMFMT_U64_MAX_DECIMAL_DIGITS 20
+#define NUMFMT_U128_MAX_DECIMAL_DIGITS 39
+#define NUMFMT_U64_MAX_HEX_DIGITS 16
+#define NUMFMT_U128_MAX_HEX_DIGITS 32
+#define NUMFMT_U64_MAX_BINARY_DIGITS 64
+#define NUMFMT_U128_MAX_BINARY_DIGITS 128
+
+/*
+ * Integer to decimal conversion without division instructions on the hot path:
+ * digits are emitted two at a time from a digit pair table, division by powers of ten
+ * is done with multiplications by constants, and wide values are split into 8 digit
+ * chunks (divide-and-conquer) so that most of the work runs on 32-bit integers.
+ *
+ * Hex and binary lengths come from bit length, digits are produced a byte of input at a time
+ * (hex pair table, binary by spreading byte bits with single multiplication).
+ *
+ * All formatters write NUL terminated string without prefix or sign and return its length,
+ * output buffer must hold at least max digits + 1 bytes.
+ *
+ * Parsers take digits only - no blanks, sign or radix prefix - of radix 2, 10 or 16 and return pointer
+ * past the last digit, or NULL when there is no digit or the value does not fit. Runs of 8 decimal
+ * digits are converted at once (SWAR), so they never read past the digits themselves.
+ */
+
+// ------------------------------
+// Function definitions
+// ------------------------------
+
+/* Number of decimal digits of value, 0 has one digit */
+size_t NumFmtU64DecimalLength(uint64_t value);
+
+size_t NumFmtU64ToDecimal(uint64_t value, char *out);
+
+size_t NumFmtU128ToDecimal(unsigned __int128 value, char *out);
+
+size_t NumFmtU64ToHex(uint64_t value, char *out);
+
+size_t NumFmtU128ToHex(unsigned __int128 value, char *out);
+
+size_t NumFmtU64ToBinary(uint64_t value, char *out);
+
+size_t NumFmtU128ToBinary(unsigned __int128 value, char *out);
+
+const char *NumFmtParseU64(const char *str, unsigned radix, uint64_t *value);
+
+const char *NumFmtParseU128(const char *str, unsigned radix, unsigned __int128 *value);
+
+#endif // NUMFMT_H
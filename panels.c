@@ -0,0 +1,343 @@
+#define _GNU_SOURCE
+
+#include "panels.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+// ------------------------------
+// defines
+// ------------------------------
+
+#define PANELS_EPOLL_BATCH 32
+
+// ------------------------------
+// Static helpers
+// ------------------------------
+
+static uint64_t NowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+/* Drains pending edges of the panel, presses toggle the led of the same index */
+static void ServePanel(panel_t *panel) {
+    gpio_cdev_event_t events[GPIO_CDEV_EVENT_BATCH];
+    const ssize_t count = GpioCdevReadEvents(&panel->buttons, events, GPIO_CDEV_EVENT_BATCH);
+
+    if (count <= 0) {
+        return;
+    }
+
+    uint64_t toggled = 0;
+
+    for (ssize_t i = 0; i < count; i++) {
+        if (panel->last_seqno != 0 && events[i].seqno != panel->last_seqno + 1) {
+            panel->num_dropped += events[i].seqno - panel->last_seqno - 1;
+        }
+        panel->last_seqno = events[i].seqno;
+
+        if (events[i].rising && events[i].line_idx < panel->leds.num_lines) {
+            toggled ^= (uint64_t) 1 << events[i].line_idx;
+        }
+    }
+
+    /* whole batch ends with single write */
+    if (toggled != 0) {
+        panel->led_bits ^= toggled;
+        GpioCdevSetValues(&panel->leds, toggled, panel->led_bits);
+    }
+
+    const uint64_t now = NowNs();
+
+    for (ssize_t i = 0; i < count; i++) {
+        const uint64_t latency_ns = now > events[i].timestamp_ns ? now - events[i].timestamp_ns : 0;
+
+        panel->total_latency_ns += latency_ns;
+        panel->max_latency_ns = latency_ns > panel->max_latency_ns ? latency_ns : panel->max_latency_ns;
+    }
+
+    panel->num_events += (uint64_t) count;
+}
+
+static int WatchPanel(const int epoll_fd, panel_t *panel) {
+    struct epoll_event event = {
+        .events = EPOLLIN | EPOLLPRI,
+        .data.ptr = panel,
+    };
+
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, panel->buttons.fd, &event);
+}
+
+/* Serves all panels from the calling thread for a while and records their event rates */
+static int Calibrate(panel_t *panels, const size_t num_panels, const uint64_t calibration_ms) {
+    const int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < num_panels; i++) {
+        if (WatchPanel(epoll_fd, &panels[i]) < 0) {
+            close(epoll_fd);
+            return -1;
+        }
+    }
+
+    const uint64_t start = NowNs();
+    const uint64_t end = start + calibration_ms * 1000000ULL;
+
+    for (uint64_t now = start; now < end; now = NowNs()) {
+        struct epoll_event events[PANELS_EPOLL_BATCH];
+        const int count = epoll_wait(epoll_fd, events, PANELS_EPOLL_BATCH, (int) ((end - now) / 1000000ULL) + 1);
+
+        for (int i = 0; i < count; i++) {
+            ServePanel(events[i].data.ptr);
+        }
+    }
+
+    close(epoll_fd);
+
+    /* edges were served meanwhile, only counters start over */
+    const double seconds = (double) (NowNs() - start) / 1e9;
+
+    for (size_t i = 0; i < num_panels; i++) {
+        panels[i].rate = (double) panels[i].num_events / seconds;
+        panels[i].num_events = 0;
+        panels[i].num_dropped = 0;
+        panels[i].total_latency_ns = 0;
+        panels[i].max_latency_ns = 0;
+    }
+
+    return 0;
+}
+
+static int CompareRates(const void *lhs, const void *rhs) {
+    const panel_t *a = *(panel_t *const *) lhs;
+    const panel_t *b = *(panel_t *const *) rhs;
+
+    if (a->rate != b->rate) {
+        return a->rate > b->rate ? -1 : 1;
+    }
+
+    /* keeps assignment deterministic for equally busy panels */
+    return a < b ? -1 : a > b;
+}
+
+/* Longest processing time first - busiest remaining panel goes to the least loaded shard */
+static void AssignShards(panel_t *panels, const size_t num_panels, shard_t *shards, const size_t num_shards) {
+    panel_t *order[PANELS_MAX_PANELS];
+
+    for (size_t i = 0; i < num_panels; i++) {
+        order[i] = &panels[i];
+    }
+
+    qsort(order, num_panels, sizeof(order[0]), CompareRates);
+
+    for (size_t i = 0; i < num_panels; i++) {
+        size_t best = 0;
+
+        for (size_t j = 1; j < num_shards; j++) {
+            const bool lighter = shards[j].load < shards[best].load ||
+                                 (shards[j].load == shards[best].load &&
+                                  shards[j].num_panels < shards[best].num_panels);
+            best = lighter ? j : best;
+        }
+
+        order[i]->shard = best;
+        shards[best].panels[shards[best].num_panels++] = order[i];
+        shards[best].load += order[i]->rate;
+    }
+}
+
+static void *ShardThread(void *arg) {
+    shard_t *shard = arg;
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(shard->cpu, &cpus);
+
+    /* pinning is an optimization only, shard works unpinned as well */
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+        fprintf(stderr, "Failed to pin shard to cpu %d\n", shard->cpu);
+    }
+
+    for (;;) {
+        struct epoll_event events[PANELS_EPOLL_BATCH];
+        const int count = epoll_wait(shard->epoll_fd, events, PANELS_EPOLL_BATCH, -1);
+
+        if (count < 0 && errno != EINTR) {
+            return NULL;
+        }
+
+        for (int i = 0; i < count; i++) {
+            /* stop eventfd is registered without panel */
+            if (events[i].data.ptr == NULL) {
+                return NULL;
+            }
+
+            ServePanel(events[i].data.ptr);
+        }
+    }
+}
+
+static int OpenPanel(panel_t *panel, const panels_options_t *options) {
+    const int chip_fd = GpioCdevOpenChip(panel->chip_path);
+    if (chip_fd < 0) {
+        return -1;
+    }
+
+    int ret = GpioCdevRequestInputs(&panel->buttons, chip_fd, options->button_offsets, options->num_buttons,
+                                    options->debounce_us);
+
+    if (ret == 0) {
+        ret = GpioCdevRequestOutputs(&panel->leds, chip_fd, options->led_offsets, options->num_leds, 0);
+
+        if (ret < 0) {
+            GpioCdevRelease(&panel->buttons);
+        }
+    }
+
+    /* line request fds stay valid after chip is closed */
+    GpioCdevCloseChip(chip_fd);
+    return ret;
+}
+
+static void PrintStatistics(const panel_t *panels, const size_t num_panels, const shard_t *shards,
+                            const size_t num_shards) {
+    for (size_t i = 0; i < num_shards; i++) {
+        printf("Shard %zu on cpu %d: %zu panels, %.1f events/s at calibration\n", i, shards[i].cpu,
+               shards[i].num_panels, shards[i].load);
+    }
+
+    for (size_t i = 0; i < num_panels; i++) {
+        const panel_t *panel = &panels[i];
+
+        printf("Panel %zu (%s): shard %zu, %lu events, %lu dropped, latency avg %lu ns, max %lu ns\n", i,
+               panel->chip_path, panel->shard, panel->num_events, panel->num_dropped,
+               panel->num_events ? panel->total_latency_ns / panel->num_events : 0, panel->max_latency_ns);
+    }
+}
+
+// ------------------------------
+// Function implementations
+// ------------------------------
+
+int PanelsRun(const panels_options_t *options) {
+    if (options->num_panels == 0 || options->num_panels > PANELS_MAX_PANELS || options->num_shards == 0 ||
+        options->num_shards > PANELS_MAX_SHARDS) {
+        return -1;
+    }
+
+    /* shard without panels would only burn a thread */
+    const size_t num_shards = options->num_shards < options->num_panels ? options->num_shards : options->num_panels;
+    panel_t *panels = calloc(options->num_panels, sizeof(panel_t));
+    shard_t *shards = calloc(num_shards, sizeof(shard_t));
+    size_t num_open = 0;
+    size_t num_started = 0;
+    int ret = panels == NULL || shards == NULL ? -1 : 0;
+
+    for (; ret == 0 && num_open < options->num_panels; num_open++) {
+        panels[num_open].chip_path = options->chip_paths[num_open];
+
+        if (OpenPanel(&panels[num_open], options) < 0) {
+            fprintf(stderr, "Failed to open panel %s: %s\n", options->chip_paths[num_open], strerror(errno));
+            ret = -1;
+            break;
+        }
+    }
+
+    /* shutdown signals are taken by sigwait below, shards inherit the mask */
+    sigset_t stop_signals;
+    sigset_t old_signals;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, &old_signals);
+
+    if (ret == 0) {
+        ret = Calibrate(panels, options->num_panels, options->calibration_ms);
+    }
+
+    if (ret == 0) {
+        AssignShards(panels, options->num_panels, shards, num_shards);
+    }
+
+    const long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (; ret == 0 && num_started < num_shards; num_started++) {
+        shard_t *shard = &shards[num_started];
+        struct epoll_event stop_event = {.events = EPOLLIN, .data.ptr = NULL};
+
+        shard->cpu = (int) (num_started % (size_t) (num_cpus > 0 ? num_cpus : 1));
+        shard->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        shard->stop_fd = eventfd(0, EFD_CLOEXEC);
+        ret = shard->epoll_fd < 0 || shard->stop_fd < 0 ? -1 : 0;
+
+        for (size_t i = 0; ret == 0 && i < shard->num_panels; i++) {
+            ret = WatchPanel(shard->epoll_fd, shard->panels[i]);
+        }
+
+        if (ret == 0) {
+            ret = epoll_ctl(shard->epoll_fd, EPOLL_CTL_ADD, shard->stop_fd, &stop_event);
+        }
+
+        if (ret == 0 && pthread_create(&shard->thread, NULL, ShardThread, shard) != 0) {
+            ret = -1;
+        }
+
+        if (ret < 0) {
+            fprintf(stderr, "Failed to start shard %zu: %s\n", num_started, strerror(errno));
+
+            if (shard->epoll_fd >= 0) {
+                close(shard->epoll_fd);
+            }
+            if (shard->stop_fd >= 0) {
+                close(shard->stop_fd);
+            }
+            break;
+        }
+    }
+
+    if (ret == 0) {
+        printf("Serving %zu panels on %zu shards, press Ctrl+C to stop\n", options->num_panels, num_shards);
+
+        int signal;
+        sigwait(&stop_signals, &signal);
+    }
+
+    for (size_t i = 0; i < num_started; i++) {
+        const uint64_t one = 1;
+
+        if (write(shards[i].stop_fd, &one, sizeof(one)) == sizeof(one)) {
+            pthread_join(shards[i].thread, NULL);
+        }
+
+        close(shards[i].epoll_fd);
+        close(shards[i].stop_fd);
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+    if (ret == 0) {
+        PrintStatistics(panels, options->num_panels, shards, num_shards);
+    }
+
+    for (size_t i = 0; i < num_open; i++) {
+        GpioCdevSetValues(&panels[i].leds, (1ULL << panels[i].leds.num_lines) - 1, 0);
+        GpioCdevRelease(&panels[i].buttons);
+        GpioCdevRelease(&panels[i].leds);
+    }
+
+    free(panels);
+    free(shards);
+    return ret;
+}
@@ -0,0 +1,76 @@
+#ifndef PANELS_H
+#define PANELS_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gpio_cdev.h"
+
+// ------------------------------
+// defines
+// ------------------------------
+
+#define PANELS_MAX_PANELS 256
+#define PANELS_MAX_SHARDS 64
+/* all panels share single loop for that long at startup, measured event rates drive shard assignment */
+#define PANELS_DEFAULT_CALIBRATION_MS 2000
+
+/*
+ * Single button/led panel behind its own gpio chip. Panel is owned by exactly one shard,
+ * which is the only thread touching its lines and counters, so nothing here is locked.
+ */
+typedef struct Panel {
+    const char *chip_path;
+    gpio_cdev_lines_t buttons;
+    gpio_cdev_lines_t leds;
+    uint64_t led_bits;
+
+    size_t shard;
+    /* events per second seen during calibration */
+    double rate;
+
+    /* statistics, edge latency is measured from kernel timestamp to the led write */
+    uint64_t num_events;
+    uint64_t num_dropped;
+    uint64_t total_latency_ns;
+    uint64_t max_latency_ns;
+    uint32_t last_seqno;
+} panel_t;
+
+/* event loop thread pinned to single cpu, serves panels assigned to it */
+typedef struct Shard {
+    pthread_t thread;
+    int epoll_fd;
+    /* eventfd waking the loop for shutdown, so the loop has no timeout */
+    int stop_fd;
+    int cpu;
+    panel_t *panels[PANELS_MAX_PANELS];
+    size_t num_panels;
+    double load;
+} shard_t;
+
+typedef struct PanelsOptions {
+    const char *const *chip_paths;
+    size_t num_panels;
+    size_t num_shards;
+    const int *button_offsets;
+    size_t num_buttons;
+    const int *led_offsets;
+    size_t num_leds;
+    uint32_t debounce_us;
+    uint64_t calibration_ms;
+} panels_options_t;
+
+// ------------------------------
+// Function definitions
+// ------------------------------
+
+/*
+ * Serves every panel until SIGINT or SIGTERM: button presses toggle the matching led of the same panel.
+ * Prints per panel statistics at exit, returns negative value when any panel or shard could not be set up.
+ */
+int PanelsRun(const panels_options_t *options);
+
+#endif // PANELS_H
@@ -0,0 +1,124 @@
+#include "pwm.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+
+// ------------------------------
+// Static helpers
+// ------------------------------
+
+static void AddNs(struct timespec *ts, const uint64_t ns) {
+    ts->tv_nsec += (long) (ns % 1000000000ULL);
+    ts->tv_sec += (time_t) (ns / 1000000000ULL);
+
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_nsec -= 1000000000L;
+        ts->tv_sec++;
+    }
+}
+
+static int64_t DiffNs(const struct timespec *a, const struct timespec *b) {
+    return (int64_t) (a->tv_sec - b->tv_sec) * 1000000000LL + (a->tv_nsec - b->tv_nsec);
+}
+
+static void *PwmThread(void *arg) {
+    pwm_engine_t *pwm = arg;
+    const size_t num_slots = pwm->num_levels - 1;
+
+    /* low jitter needs real-time priority, but lack of privileges is not fatal */
+    struct sched_param param = {.sched_priority = sched_get_priority_min(SCHED_FIFO)};
+    pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+    uint64_t last_bits = UINT64_MAX;
+    size_t slot = 0;
+
+    while (atomic_load_explicit(&pwm->running, memory_order_relaxed)) {
+        const uint64_t masks = atomic_load_explicit(&pwm->slot_masks, memory_order_acquire);
+        const uint64_t bits = (masks >> (slot * PWM_SLOT_BITS)) & ((1U << PWM_SLOT_BITS) - 1);
+
+        if (bits != last_bits) {
+            pwm->writer(bits, pwm->writer_ctx);
+            last_bits = bits;
+            pwm->num_writes++;
+        }
+
+        slot = slot + 1 == num_slots ? 0 : slot + 1;
+        AddNs(&deadline, pwm->slot_ns);
+
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {}
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        const int64_t lateness = DiffNs(&now, &deadline);
+        if (lateness > 0) {
+            pwm->total_lateness_ns += (uint64_t) lateness;
+
+            if ((uint64_t) lateness > pwm->max_lateness_ns) {
+                pwm->max_lateness_ns = (uint64_t) lateness;
+            }
+        }
+        pwm->num_wakeups++;
+    }
+
+    return NULL;
+}
+
+// ------------------------------
+// Function implementations
+// ------------------------------
+
+int PwmStart(pwm_engine_t *pwm, const size_t num_channels, const unsigned num_levels, const uint64_t period_us,
+             const pwm_bank_writer_t writer, void *writer_ctx) {
+    if (num_channels == 0 || num_channels > PWM_MAX_CHANNELS ||
+        num_levels < PWM_MIN_LEVELS || num_levels > PWM_MAX_LEVELS || period_us == 0) {
+        return -1;
+    }
+
+    pwm->writer = writer;
+    pwm->writer_ctx = writer_ctx;
+    pwm->num_channels = num_channels;
+    pwm->num_levels = num_levels;
+    pwm->slot_ns = period_us * 1000 / (num_levels - 1);
+
+    pwm->max_lateness_ns = 0;
+    pwm->total_lateness_ns = 0;
+    pwm->num_wakeups = 0;
+    pwm->num_writes = 0;
+
+    atomic_store(&pwm->slot_masks, 0);
+    atomic_store(&pwm->running, true);
+
+    if (pthread_create(&pwm->thread, NULL, PwmThread, pwm) != 0) {
+        atomic_store(&pwm->running, false);
+        return -1;
+    }
+
+    return 0;
+}
+
+void PwmStop(pwm_engine_t *pwm) {
+    if (!atomic_exchange(&pwm->running, false)) {
+        return;
+    }
+
+    pthread_join(pwm->thread, NULL);
+}
+
+void PwmSetLevels(pwm_engine_t *pwm, const uint8_t *levels) {
+    uint64_t masks = 0;
+
+    for (size_t slot = 0; slot + 1 < pwm->num_levels; slot++) {
+        for (size_t ch = 0; ch < pwm->num_channels; ch++) {
+            if (levels[ch] > slot) {
+                masks |= (uint64_t) 1 << (slot * PWM_SLOT_BITS + ch);
+            }
+        }
+    }
+
+    atomic_store_explicit(&pwm->slot_masks, masks, memory_order_release);
+}
@@ -0,0 +1,67 @@
+#ifndef PWM_H
+#define PWM_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// ------------------------------
+// defines
+// ------------------------------
+
+#define PWM_MAX_CHANNELS 8
+#define PWM_MIN_LEVELS 2
+#define PWM_MAX_LEVELS 4
+
+/* one slot less than levels - level n keeps channel on for first n slots of the period */
+#define PWM_MAX_SLOTS (PWM_MAX_LEVELS - 1)
+#define PWM_SLOT_BITS 8
+
+#define PWM_DEFAULT_PERIOD_US 9000
+
+_Static_assert(PWM_MAX_CHANNELS <= PWM_SLOT_BITS, "Slot mask must fit its packed field");
+_Static_assert(PWM_MAX_SLOTS * PWM_SLOT_BITS <= 64, "All slot masks must fit single atomic word");
+
+/* writes state of all channels at once, bit i holds channel i */
+typedef void (*pwm_bank_writer_t)(uint64_t bits, void *ctx);
+
+/*
+ * Timer driven software PWM. Dedicated thread wakes up on absolute deadlines at the start
+ * of every slot and writes the whole bank once per slot (only when it differs from the previous slot).
+ * Levels are published as packed per-slot masks in single atomic word, so the thread never takes a lock.
+ */
+typedef struct PwmEngine {
+    pthread_t thread;
+    pwm_bank_writer_t writer;
+    void *writer_ctx;
+
+    size_t num_channels;
+    unsigned num_levels;
+    uint64_t slot_ns;
+
+    _Atomic uint64_t slot_masks;
+    _Atomic bool running;
+
+    /* statistics, valid after PwmStop */
+    uint64_t max_lateness_ns;
+    uint64_t total_lateness_ns;
+    uint64_t num_wakeups;
+    uint64_t num_writes;
+} pwm_engine_t;
+
+// ------------------------------
+// Function definitions
+// ------------------------------
+
+/* Returns negative value on invalid configuration or when thread could not be started */
+int PwmStart(pwm_engine_t *pwm, size_t num_channels, unsigned num_levels, uint64_t period_us,
+             pwm_bank_writer_t writer, void *writer_ctx);
+
+void PwmStop(pwm_engine_t *pwm);
+
+/* levels[i] in range [0, num_levels) sets brightness of channel i */
+void PwmSetLevels(pwm_engine_t *pwm, const uint8_t *levels);
+
+#endif // PWM_H
@@ -0,0 +1,134 @@
+#include "snapshot.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// ------------------------------
+// Static helpers
+// ------------------------------
+
+static size_t SlotSize(const size_t state_size) {
+    const size_t size = sizeof(snapshot_slot_t) + state_size;
+    return (size + SNAPSHOT_ALIGNMENT - 1) & ~(size_t) (SNAPSHOT_ALIGNMENT - 1);
+}
+
+/* FNV-1a, state is few hundred bytes so byte loop costs well below microsecond */
+static uint64_t Checksum(const uint64_t seq, const unsigned char *state, const size_t state_size) {
+    uint64_t hash = 0xcbf29ce484222325ULL ^ seq;
+
+    for (size_t i = 0; i < state_size; i++) {
+        hash ^= state[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+static bool IsSlotIntact(const snapshot_slot_t *slot, const size_t state_size, uint64_t *seq) {
+    *seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    return *seq != 0 && slot->checksum == Checksum(*seq, slot->state, state_size);
+}
+
+// ------------------------------
+// Function implementations
+// ------------------------------
+
+int SnapshotOpen(snapshot_t *snapshot, const char *path, const size_t state_size, const uint32_t version) {
+    const size_t size = sizeof(snapshot_header_t) + SNAPSHOT_NUM_SLOTS * SlotSize(state_size);
+
+    const int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    /* short file is started over below, truncation to zero drops whatever it held */
+    if ((size_t) st.st_size != size && (ftruncate(fd, 0) != 0 || ftruncate(fd, (off_t) size) != 0)) {
+        close(fd);
+        return -1;
+    }
+
+    /* populated upfront, so the first store does not fault */
+    char *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+
+    snapshot_header_t *header = (snapshot_header_t *) base;
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 || header->version != version ||
+        header->state_size != state_size) {
+        memset(base, 0, size);
+        memcpy(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic));
+        header->version = version;
+        header->state_size = (uint32_t) state_size;
+    }
+
+    snapshot->fd = fd;
+    snapshot->base = base;
+    snapshot->size = size;
+    snapshot->state_size = state_size;
+    snapshot->seq = 0;
+
+    for (size_t i = 0; i < SNAPSHOT_NUM_SLOTS; i++) {
+        snapshot->slots[i] = (snapshot_slot_t *) (base + sizeof(snapshot_header_t) + i * SlotSize(state_size));
+
+        /* torn slot is not newest one, its seq would be overwritten first anyway */
+        uint64_t seq;
+        if (IsSlotIntact(snapshot->slots[i], state_size, &seq) && seq > snapshot->seq) {
+            snapshot->seq = seq;
+        }
+    }
+
+    return 0;
+}
+
+bool SnapshotLoad(const snapshot_t *snapshot, void *state) {
+    const snapshot_slot_t *newest = NULL;
+    uint64_t newest_seq = 0;
+
+    for (size_t i = 0; i < SNAPSHOT_NUM_SLOTS; i++) {
+        uint64_t seq;
+        if (IsSlotIntact(snapshot->slots[i], snapshot->state_size, &seq) && seq > newest_seq) {
+            newest = snapshot->slots[i];
+            newest_seq = seq;
+        }
+    }
+
+    if (newest == NULL) {
+        return false;
+    }
+
+    memcpy(state, newest->state, snapshot->state_size);
+    return true;
+}
+
+void SnapshotStore(snapshot_t *snapshot, const void *state) {
+    const uint64_t seq = snapshot->seq + 1;
+    snapshot_slot_t *slot = snapshot->slots[seq % SNAPSHOT_NUM_SLOTS];
+
+    /* single writer, ordering only keeps state stores between invalidation and publication */
+    atomic_store_explicit(&slot->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    memcpy(slot->state, state, snapshot->state_size);
+    slot->checksum = Checksum(seq, slot->state, snapshot->state_size);
+
+    atomic_store_explicit(&slot->seq, seq, memory_order_release);
+    snapshot->seq = seq;
+}
+
+void SnapshotClose(snapshot_t *snapshot) {
+    munmap(snapshot->base, snapshot->size);
+    close(snapshot->fd);
+
+    snapshot->base = NULL;
+}
@@ -0,0 +1,66 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// ------------------------------
+// defines
+// ------------------------------
+
+#define SNAPSHOT_MAGIC "LSWSNAP\0"
+#define SNAPSHOT_ALIGNMENT 64
+#define SNAPSHOT_NUM_SLOTS 2
+
+/*
+ * State file: header | slot 0 | slot 1, slot being seq, checksum and state_size bytes of opaque state.
+ *
+ * Stores alternate between slots, so the previous state stays intact while the next one is written.
+ * Slot is invalidated first, filled and then published by its new seq. Mapping is shared, so stores
+ * land in page cache and survive the process dying at any point without fsync. Checksum catches
+ * slot torn by power loss; such slot is skipped and the older one is used.
+ */
+typedef struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t state_size;
+    uint32_t reserved[12];
+} snapshot_header_t;
+
+_Static_assert(sizeof(snapshot_header_t) == SNAPSHOT_ALIGNMENT, "Header must keep first slot aligned");
+
+typedef struct SnapshotSlot {
+    /* 0 marks slot never written or being written */
+    _Atomic uint64_t seq;
+    uint64_t checksum;
+    unsigned char state[];
+} snapshot_slot_t;
+
+typedef struct Snapshot {
+    int fd;
+    void *base;
+    size_t size;
+    size_t state_size;
+    snapshot_slot_t *slots[SNAPSHOT_NUM_SLOTS];
+    /* seq of the newest published slot */
+    uint64_t seq;
+} snapshot_t;
+
+// ------------------------------
+// Function definitions
+// ------------------------------
+
+/* Maps state file at path, file of other version or state size is started over */
+int SnapshotOpen(snapshot_t *snapshot, const char *path, size_t state_size, uint32_t version);
+
+/* Copies newest intact state, returns false when there is none */
+bool SnapshotLoad(const snapshot_t *snapshot, void *state);
+
+/* Publishes state into the older slot, no syscall involved */
+void SnapshotStore(snapshot_t *snapshot, const void *state);
+
+void SnapshotClose(snapshot_t *snapshot);
+
+#endif // SNAPSHOT_H
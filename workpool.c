@@ -0,0 +1,197 @@
+#include "workpool.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+// ------------------------------
+// Static helpers
+// ------------------------------
+
+static bool DequePushTail(work_deque_t *deque, const size_t item) {
+    pthread_mutex_lock(&deque->lock);
+
+    const bool has_room = deque->tail - deque->head < deque->capacity;
+    if (has_room) {
+        deque->items[deque->tail++ % deque->capacity] = item;
+    }
+
+    pthread_mutex_unlock(&deque->lock);
+    return has_room;
+}
+
+static bool DequePopTail(work_deque_t *deque, size_t *item) {
+    pthread_mutex_lock(&deque->lock);
+
+    const bool has_item = deque->tail != deque->head;
+    if (has_item) {
+        *item = deque->items[--deque->tail % deque->capacity];
+    }
+
+    pthread_mutex_unlock(&deque->lock);
+    return has_item;
+}
+
+static bool DequePopHead(work_deque_t *deque, size_t *item) {
+    pthread_mutex_lock(&deque->lock);
+
+    const bool has_item = deque->tail != deque->head;
+    if (has_item) {
+        *item = deque->items[deque->head++ % deque->capacity];
+    }
+
+    pthread_mutex_unlock(&deque->lock);
+    return has_item;
+}
+
+static bool TakeItem(work_pool_t *pool, const size_t worker, size_t *item) {
+    if (DequePopTail(&pool->deques[worker], item)) {
+        return true;
+    }
+
+    /* steal, starting right after own deque so that thieves spread over victims */
+    for (size_t i = 1; i < pool->num_workers; i++) {
+        if (DequePopHead(&pool->deques[(worker + i) % pool->num_workers], item)) {
+            atomic_fetch_add_explicit(&pool->num_stolen, 1, memory_order_relaxed);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+typedef struct WorkerArgs {
+    work_pool_t *pool;
+    size_t worker;
+} worker_args_t;
+
+static void *WorkerThread(void *arg) {
+    work_pool_t *pool = ((worker_args_t *) arg)->pool;
+    const size_t worker = ((worker_args_t *) arg)->worker;
+    free(arg);
+
+    for (;;) {
+        size_t item;
+
+        if (TakeItem(pool, worker, &item)) {
+            atomic_fetch_sub_explicit(&pool->num_queued, 1, memory_order_relaxed);
+            pool->fn(pool->ctx, item, worker);
+            atomic_fetch_add_explicit(&pool->num_executed, 1, memory_order_relaxed);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->idle_lock);
+
+        /* queued counter is bumped before the wakeup under the same lock, so no submission is missed */
+        while (atomic_load(&pool->num_queued) == 0 && atomic_load(&pool->running)) {
+            pthread_cond_wait(&pool->idle_cond, &pool->idle_lock);
+        }
+
+        const bool finished = atomic_load(&pool->num_queued) == 0 && !atomic_load(&pool->running);
+        pthread_mutex_unlock(&pool->idle_lock);
+
+        if (finished) {
+            return NULL;
+        }
+    }
+}
+
+// ------------------------------
+// Function implementations
+// ------------------------------
+
+size_t WorkPoolDefaultWorkers() {
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (cpus < 1) {
+        return 1;
+    }
+
+    return (size_t) cpus < WORK_POOL_MAX_WORKERS ? (size_t) cpus : WORK_POOL_MAX_WORKERS;
+}
+
+int WorkPoolStart(work_pool_t *pool, const size_t num_workers, const size_t capacity, const work_fn_t fn,
+                  void *ctx) {
+    if (num_workers == 0 || num_workers > WORK_POOL_MAX_WORKERS || capacity == 0) {
+        return -1;
+    }
+
+    pool->num_workers = 0;
+    pool->next_deque = 0;
+    pool->fn = fn;
+    pool->ctx = ctx;
+    pthread_mutex_init(&pool->idle_lock, NULL);
+    pthread_cond_init(&pool->idle_cond, NULL);
+    atomic_store(&pool->num_queued, 0);
+    atomic_store(&pool->running, true);
+    atomic_store(&pool->num_executed, 0);
+    atomic_store(&pool->num_stolen, 0);
+
+    for (size_t i = 0; i < num_workers; i++) {
+        work_deque_t *deque = &pool->deques[i];
+
+        pthread_mutex_init(&deque->lock, NULL);
+        deque->items = malloc(capacity * sizeof(size_t));
+        deque->capacity = capacity;
+        deque->head = 0;
+        deque->tail = 0;
+
+        worker_args_t *args = malloc(sizeof(worker_args_t));
+
+        if (deque->items == NULL || args == NULL) {
+            free(args);
+            free(deque->items);
+            WorkPoolStop(pool);
+            return -1;
+        }
+
+        args->pool = pool;
+        args->worker = i;
+
+        if (pthread_create(&pool->threads[i], NULL, WorkerThread, args) != 0) {
+            free(args);
+            free(deque->items);
+            WorkPoolStop(pool);
+            return -1;
+        }
+
+        pool->num_workers++;
+    }
+
+    return 0;
+}
+
+bool WorkPoolSubmit(work_pool_t *pool, const size_t item) {
+    work_deque_t *deque = &pool->deques[pool->next_deque];
+    pool->next_deque = (pool->next_deque + 1) % pool->num_workers;
+
+    /* count the item first, so that it is never decremented below zero by the worker taking it */
+    atomic_fetch_add(&pool->num_queued, 1);
+
+    if (!DequePushTail(deque, item)) {
+        atomic_fetch_sub(&pool->num_queued, 1);
+        return false;
+    }
+
+    pthread_mutex_lock(&pool->idle_lock);
+    pthread_cond_signal(&pool->idle_cond);
+    pthread_mutex_unlock(&pool->idle_lock);
+
+    return true;
+}
+
+void WorkPoolStop(work_pool_t *pool) {
+    pthread_mutex_lock(&pool->idle_lock);
+    atomic_store(&pool->running, false);
+    pthread_cond_broadcast(&pool->idle_cond);
+    pthread_mutex_unlock(&pool->idle_lock);
+
+    for (size_t i = 0; i < pool->num_workers; i++) {
+        pthread_join(pool->threads[i], NULL);
+        pthread_mutex_destroy(&pool->deques[i].lock);
+        free(pool->deques[i].items);
+    }
+
+    pool->num_workers = 0;
+    pthread_mutex_destroy(&pool->idle_lock);
+    pthread_cond_destroy(&pool->idle_cond);
+}
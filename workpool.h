@@ -0,0 +1,75 @@
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// ------------------------------
+// defines
+// ------------------------------
+
+#define WORK_POOL_MAX_WORKERS 64
+
+/* processes single item, worker is index of the calling thread */
+typedef void (*work_fn_t)(void *ctx, size_t item, size_t worker);
+
+/*
+ * Ring of item indices owned by single worker. Owner pushes and pops at the tail (LIFO keeps
+ * its caches warm), thieves take from the head, i.e. the oldest and usually largest remaining work.
+ * Deques are tiny and touched once per item, so plain mutex is enough.
+ */
+typedef struct WorkDeque {
+    pthread_mutex_t lock;
+    size_t *items;
+    size_t capacity;
+    size_t head;
+    size_t tail;
+} work_deque_t;
+
+/*
+ * Fixed set of threads executing submitted items. Submitter spreads items round robin,
+ * idle workers steal from others before going to sleep.
+ */
+typedef struct WorkPool {
+    pthread_t threads[WORK_POOL_MAX_WORKERS];
+    work_deque_t deques[WORK_POOL_MAX_WORKERS];
+    size_t num_workers;
+    size_t next_deque;
+
+    work_fn_t fn;
+    void *ctx;
+
+    /* sleeping workers wait for queued items or shutdown */
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cond;
+    _Atomic size_t num_queued;
+    _Atomic bool running;
+
+    /* statistics */
+    _Atomic uint64_t num_executed;
+    _Atomic uint64_t num_stolen;
+} work_pool_t;
+
+// ------------------------------
+// Function definitions
+// ------------------------------
+
+/* Number of online cpus, at least 1 */
+size_t WorkPoolDefaultWorkers();
+
+/*
+ * Starts num_workers threads, every deque holds at most capacity items at once.
+ * Returns negative value when threads or memory could not be obtained.
+ */
+int WorkPoolStart(work_pool_t *pool, size_t num_workers, size_t capacity, work_fn_t fn, void *ctx);
+
+/* Queues item, returns false when deque picked for it is full */
+bool WorkPoolSubmit(work_pool_t *pool, size_t item);
+
+/* Finishes every queued item and joins the threads */
+void WorkPoolStop(work_pool_t *pool);
+
+#endif // WORKPOOL_H